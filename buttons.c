@@ -7,24 +7,53 @@
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include "buttons.h"
+#include "input.h"
+#include "timer0.h"
 
 // Global variable to keep track of the last button state so that we 
 // can detect changes when an interrupt fires. The lower 4 bits (0 to 3)
 // will correspond to the last state of port B pins 0 to 3.
 static volatile uint8_t last_button_state;
 
-// Our button queue. button_queue[0] is always the head of the queue. If we
-// take something off the queue we just move everything else along. We don't
-// use a circular buffer since it is usually expected that the queue is very
-// short. In most uses it will never have more than 1 element at a time.
-// This button queue can be changed by the interrupt handler below so we should
-// turn off interrupts if we're changing the queue outside the handler.
-#define BUTTON_QUEUE_SIZE 8
-static volatile uint8_t button_queue[BUTTON_QUEUE_SIZE];
-static volatile int8_t queue_length;
-static volatile uint8_t x_or_y = 0;	/* 0 = x, 1 = y */
-static volatile uint8_t most_recent_joystick;
-static volatile	uint8_t no_change_in_x, no_change_in_y;
+// Debouncing. When a button changes we act on it straight away, then
+// mask its pin change interrupt for BUTTON_DEBOUNCE milliseconds so that
+// contact bounce is ignored. At the end of that time a timer 0 soft timer
+// (see button_debounce_tick()) checks the button again - if it ended up
+// in a different state from the one we reported we report that too and
+// start another lockout, otherwise we unmask the interrupt.
+// debouncing has a bit set for each button being locked out and
+// lockout_left is how many more milliseconds each lockout lasts. (This is
+// counted down by the soft timer rather than timed with the game clock,
+// which stops while the game is paused.)
+#ifndef BUTTON_DEBOUNCE
+#define BUTTON_DEBOUNCE 20
+#endif
+static volatile uint8_t debouncing;
+static volatile uint8_t lockout_left[4];
+static void button_debounce_tick(void);
+
+// Action for each button (and joystick direction). 0 = right, 1 = drop
+// block, 2 = rotate block, 3 = left
+static const uint8_t direction_actions[4] = {
+	ACTION_RIGHT, ACTION_DROP, ACTION_ROTATE, ACTION_LEFT
+};
+
+// Joystick. The ADC converts on every timer 0 compare match (every
+// millisecond) and the conversion complete interrupt alternates between
+// the two axes, so each is sampled every 2ms. An axis counts as pushed
+// once its reading goes past JOYSTICK_HIGH (or below JOYSTICK_LOW) and
+// stays pushed until it comes back by JOYSTICK_HYSTERESIS, so a reading
+// near a threshold doesn't flicker.
+#define JOYSTICK_X_CHANNEL 7
+#define JOYSTICK_Y_CHANNEL 6
+#define JOYSTICK_HIGH 700
+#define JOYSTICK_LOW 300
+#define JOYSTICK_HYSTERESIS 50
+
+// Axis positions (-1 = low, 0 = centre, 1 = high) and the joystick
+// direction (as for the buttons, or -1 if centred) - only used by the ISR
+static int8_t x_position, y_position;
+static int8_t joystick_direction = -1;
 
 // Setup interrupt if any of pins B0 to B3 change. We do this
 // using a pin change interrupt. These pins correspond to pin
@@ -42,121 +71,149 @@ void init_button_interrupts(void) {
 	// the relevant bits in the mask register (see datasheet page 70)
 	PCMSK1 |= (1<<PCINT8)|(1<<PCINT9)|(1<<PCINT10)|(1<<PCINT11);	
 	
-	// Empty the button push queue
-	queue_length = 0;
-}
-
-void empty_button_queue(void) {
-	queue_length = 0;
-	last_button_state = 0;
+	// Buttons already down don't count as pushes
+	last_button_state = PINB & 0x0F;
+	
+	// End lockouts (see above) from the timer 0 interrupt handler
+	add_soft_timer(button_debounce_tick, 1);
 }
 
 int8_t button_pushed(void) {
-	int8_t return_value = -1;	// Assume no button pushed
-	if(queue_length > 0) {
-		// Remove the first element off the queue and move all the other
-		// entries closer to the front of the queue. We turn off interrupts (if on)
-		// before we make any changes to the queue. If interrupts were on
-		// we turn them back on when done.
-		return_value = button_queue[0];
-		
+	InputEvent event;
+	
+	// Throw away everything up to the next button push
+	while(input_next_event(&event)) {
+		if(event.source == INPUT_BUTTON) {
+			for(uint8_t pin = 0; pin <= 3; pin++) {
+				if(direction_actions[pin] == event.action) {
+					return pin;
+				}
+			}
+		}
+	}
+	return -1;
+}
 
+// Report the buttons in changed (which have changed from last_button_state
+// to button_state) and lock them out. Only called with interrupts off.
+static void buttons_changed(uint8_t changed, uint8_t button_state) {
+	// Every push and release goes into the input event queue
+	for(uint8_t pin=0; pin<=3; pin++) {
+		if(changed & (1<<pin)) {
+			input_event(direction_actions[pin], (button_state & (1<<pin)) ?
+					INPUT_BUTTON : INPUT_BUTTON | INPUT_RELEASED);
+			lockout_left[pin] = BUTTON_DEBOUNCE;
+		}
 	}
-	return return_value;
+	debouncing |= changed;
+	PCMSK1 &= ~(changed<<PCINT8);
+	
+	// Remember the new state so we can detect changes next time
+	last_button_state ^= changed;
 }
 
 // Interrupt handler for a change on buttons
 ISR(PCINT1_vect) {
 	// Get the current state of the buttons. We'll compare this with
-	// the last state to see what has changed.
+	// the last state to see what has changed. Buttons which are locked
+	// out are ignored (the interrupt may have been set off by one of them
+	// just before it was masked).
 	uint8_t button_state = PINB & 0x0F;
-
-	// If we have space in the queue, then iterate over all the buttons
-	// and see which ones have changed.	If we have no space in the queue
-	// we don't bother - we just ignore the button event.  (Ideally
-	// this should never happen.)
-	if(queue_length < BUTTON_QUEUE_SIZE) {
-		// Iterate over all the buttons and see which ones have changed.
-		// Any button pushes are added to the queue of button pushes (if
-		// there is space). We ignore button releases so we're just looking
-		// for a transition from 0 in the last_button_state bit to a 1 in the
-		// button_state.
-		for(uint8_t pin=0; pin<=3; pin++) {
-			if((button_state & (1<<pin)) &&	!(last_button_state & (1<<pin))) {
-				// Add the button push to the queue (and update the
-				// length of the queue). If the queue is now full, we stop
-				// processing (i.e. ignore other button events if there
-				// are any)
-				button_queue[queue_length++] = pin;
-				if(queue_length >= BUTTON_QUEUE_SIZE) {
-					break;
-				}
-			} else if (!(button_state & (1<<pin)) && (last_button_state & (1<<pin))) {
-				queue_length = 0;
-			}
-		}
+	uint8_t changed = (button_state ^ last_button_state) & ~debouncing;
+	
+	if(changed) {
+		buttons_changed(changed, button_state);
 	}
-		
-	// Remember this button state so we can detect changes next time
-	last_button_state = button_state;
 }
 
-uint8_t joystick_input(void) {
-	//Set the ADC mux to choose ADC6 if x_or_y is 0, ADC7 is x_or_y is 1
-	if(x_or_y == 0) {
-		ADMUX |= (1<<2)|(1<<1)|(1<<0);
-	} else {
-		ADMUX &= ~1;
+// Called every millisecond by the timer 0 interrupt handler
+static void button_debounce_tick(void) {
+	if(!debouncing) {
+		return;
 	}
-	//start the conversion
-	ADCSRA |= (1<<ADSC);
-	
-	while(ADCSRA & (1<<ADSC)) {
-		; /* Wait until conversion finished */
-	}	
-	//conversion is over
 	
-	//determine a value. 0 = right, 1=drop block, 2=rotate block, 3=left
-	//check x first, then y
-	if (x_or_y == 0) {
-		if (ADC > 700) {
-			most_recent_joystick = 0;
-			no_change_in_x = 0;
-		} else if (ADC < 300) {
-			most_recent_joystick = 3;
-			no_change_in_x = 0;			
-		} else {
-			//keep most_recent_joystick what it was
-			no_change_in_x = 1;
-		}
-	} else {
-		if (ADC > 700) {
-			most_recent_joystick = 2;
-			no_change_in_y = 0;
-		} else if (ADC < 300) {
-			most_recent_joystick = 1;
-			no_change_in_y = 0;
-		} else {
-			//keep most_recent_joystick what it was			
-			no_change_in_y = 1;
+	uint8_t expired = 0;
+	for(uint8_t pin=0; pin<=3; pin++) {
+		if((debouncing & (1<<pin)) && --lockout_left[pin] == 0) {
+			expired |= (1<<pin);
 		}
 	}
-	x_or_y ^= 1;
-	
-	if(no_change_in_x && no_change_in_y) {
-		most_recent_joystick = -1;
+	if(!expired) {
+		return;
 	}
 	
-	return most_recent_joystick;
-	
+	// Unmask before reading the pins - a change after this will set off
+	// the pin change interrupt as usual
+	debouncing &= ~expired;
+	PCMSK1 |= (expired<<PCINT8);
+	uint8_t button_state = PINB & 0x0F;
+	uint8_t changed = (button_state ^ last_button_state) & expired;
+	if(changed) {
+		// Changed during the lockout (e.g. a short tap)
+		buttons_changed(changed, button_state);
+	}
 }
 
-uint8_t get_most_recent_joystick(void) {
-	return most_recent_joystick;
+void init_joystick(void) {
+	ADMUX = (1<<REFS0)|JOYSTICK_X_CHANNEL;
+	// Trigger conversions on timer 0 compare match A
+	ADCSRB = (1<<ADTS1)|(1<<ADTS0);
+	// The joystick pins are only used as analog inputs
+	DIDR0 |= (1<<ADC7D)|(1<<ADC6D);
+	// Enable the ADC with auto triggering and an interrupt on completion.
+	// Divide the clock by 64 (to 125kHz)
+	ADCSRA = (1<<ADEN)|(1<<ADATE)|(1<<ADIE)|(1<<ADPS2)|(1<<ADPS1);
 }
 
+// Work out the new position of an axis from the latest reading
+static int8_t axis_position(int8_t position, uint16_t value) {
+	if(value > JOYSTICK_HIGH ||
+			(position > 0 && value > JOYSTICK_HIGH - JOYSTICK_HYSTERESIS)) {
+		return 1;
+	}
+	if(value < JOYSTICK_LOW ||
+			(position < 0 && value < JOYSTICK_LOW + JOYSTICK_HYSTERESIS)) {
+		return -1;
+	}
+	return 0;
+}
 
-/*
-ISR(ADC) {
-	//do nothing
-}*/
\ No newline at end of file
+// Interrupt handler for a completed conversion. The next conversion won't
+// start until the next trigger so we can switch channels here.
+ISR(ADC_vect) {
+	uint16_t value = ADC;
+	
+	if((ADMUX & 0x07) == JOYSTICK_X_CHANNEL) {
+		x_position = axis_position(x_position, value);
+		ADMUX = (1<<REFS0)|JOYSTICK_Y_CHANNEL;
+	} else {
+		y_position = axis_position(y_position, value);
+		ADMUX = (1<<REFS0)|JOYSTICK_X_CHANNEL;
+	}
+	
+	// 0 = right, 1 = drop block, 2 = rotate block, 3 = left. Left/right
+	// takes priority if the joystick is pushed diagonally.
+	int8_t direction = -1;
+	if(x_position > 0) {
+		direction = 0;
+	} else if(x_position < 0) {
+		direction = 3;
+	} else if(y_position > 0) {
+		direction = 2;
+	} else if(y_position < 0) {
+		direction = 1;
+	}
+	
+	// A change of direction is a release of the old one and a push of
+	// the new one
+	if(direction != joystick_direction) {
+		if(joystick_direction != -1) {
+			input_event(direction_actions[joystick_direction],
+					INPUT_JOYSTICK | INPUT_RELEASED);
+		}
+		if(direction != -1) {
+			input_event(direction_actions[direction], INPUT_JOYSTICK);
+		}
+		joystick_direction = direction;
+	}
+}
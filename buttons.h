@@ -13,28 +13,27 @@
 
 #include <stdint.h>
 
-/* Set up pin change interrupts on pins B0 to B3.
+/* Set up pin change interrupts on pins B0 to B3. Pushes and releases are
+ * added to the input event queue (see input.h).
  * It is assumed that global interrupts are off when this function is called
- * and are enabled sometime after this function is called.
+ * and are enabled sometime after this function is called. Buttons are
+ * debounced with a timer 0 soft timer, so init_timer0() must be called too.
  */
 void init_button_interrupts(void);
 
-/* Empty the button press queue
+/* Return the next button pushed (0 to 3) or -1 if there are no button
+ * pushes waiting. Button pushes and releases (and joystick movements) go
+ * into the input event queue (see input.h) - anything in the queue before
+ * the button push is thrown away. (For waiting for a button outside the
+ * game - the game itself uses input_next_action().)
  */
-void empty_button_queue(void);
-
-/* Return the last button pushed (0 to 3) or -1 if there are no
- * button pushes to return. (A small queue of button pushes is
- * kept. This function should be called frequently enough to
- * ensure the queue does not overflow. Excess button pushes are
- * discarded.)
- */
-
 int8_t button_pushed(void);
 
-uint8_t joystick_input(void);
-
-uint8_t get_most_recent_joystick(void);
-uint8_t get_x_or_y(void);
+/* Set up the ADC to sample the joystick (ADC7 is x, ADC6 is y) in the
+ * background. Conversions are triggered by timer 0, so init_timer0()
+ * must be called too. Changes of direction are added to the input event
+ * queue (see input.h).
+ */
+void init_joystick(void);
 
 #endif /* BUTTONS_H_ */
\ No newline at end of file
@@ -15,7 +15,8 @@
 #include "score.h"
 #include "ledmatrix.h"
 #include "terminalio.h"
-#include "timer2.h"
+#include "telemetry.h"
+#include "seven_seg.h"
 #include "timer1.h"
 #include <avr/io.h>
 
@@ -35,6 +36,7 @@ static void check_for_completed_rows(int);
 static uint8_t gen_random_block(void);
 static uint8_t add_random_block(void);
 static uint8_t block_collides(FallingBlock block);
+static FallingBlock block_in_position(uint8_t rotation, uint8_t column);
 static void remove_current_block_from_board_display(void);
 static void add_current_block_to_board_display(void);
 
@@ -81,9 +83,10 @@ void init_game(void) {
 		}
 	}
 	ledmatrix_update_all(board_display);
-	fast_terminal_draw();
+	terminal_board_changed();
+	telemetry_board_replaced();
 	
-	//initialise the cleared row count on the seven_seg display (code for display in timer1.c)
+	//initialise the cleared row count on the seven_seg display (code for display in seven_seg.c)
 	cleared_row_count = 0;
 	//this function is defined in timer1.c, and simply sets the number of cleared rows
 	//to be displayed
@@ -121,6 +124,7 @@ void update_rows_on_display(uint8_t row_start, uint8_t num_rows) {
 	for(uint8_t row_num = row_start; row_num <= row_end; row_num++) {
 		ledmatrix_update_column(row_num, board_display[row_num]);
 	}
+	terminal_board_changed();
 }
 
 /*
@@ -286,6 +290,74 @@ uint8_t attempt_rotation(void) {
 	return 1;
 }
 
+/*
+ * Move the current block straight to the given rotation and column (in
+ * its current row), if it could get there from where it is by moving
+ * left and right and rotating. The search works like a flood fill:
+ * reached[r] has bit c set if the block can get to rotation r in column c,
+ * and we keep trying every move from every position reached until no new
+ * positions are found (or the target is). Only the final position is
+ * drawn. Returns 1 if the block was moved (or was already there), 0 if
+ * the target can't be reached.
+ */
+uint8_t attempt_placement(uint8_t rotation, uint8_t column) {
+	uint8_t reached[NUM_ROTATIONS] = { 0 };
+	uint8_t found_more;
+	FallingBlock tmp_block;
+	
+	if(rotation >= NUM_ROTATIONS || column >= BOARD_WIDTH) {
+		return 0;
+	}
+	reached[current_block.rotation] = (1 << current_block.column);
+	do {
+		found_more = 0;
+		for(uint8_t r = 0; r < NUM_ROTATIONS; r++) {
+			for(uint8_t c = 0; c < BOARD_WIDTH; c++) {
+				if(!(reached[r] & (1 << c))) {
+					continue;
+				}
+				// Try a move left, a move right and a rotation from here
+				for(uint8_t move = 0; move < 3; move++) {
+					int8_t moved;
+					
+					tmp_block = block_in_position(r, c);
+					if(move == 0) {
+						moved = move_block_left(&tmp_block);
+					} else if(move == 1) {
+						moved = move_block_right(&tmp_block);
+					} else {
+						moved = rotate_block(&tmp_block);
+					}
+					if(moved && !block_collides(tmp_block) &&
+							!(reached[tmp_block.rotation] & (1 << tmp_block.column))) {
+						reached[tmp_block.rotation] |= (1 << tmp_block.column);
+						found_more = 1;
+					}
+				}
+			}
+		}
+	} while(found_more && !(reached[rotation] & (1 << column)));
+	
+	if(!(reached[rotation] & (1 << column))) {
+		return 0;
+	}
+	
+	// Rows to redraw - the taller of the block before and after
+	tmp_block = block_in_position(rotation, column);
+	uint8_t rows_affected = tmp_block.height;
+	if(current_block.height > tmp_block.height) {
+		rows_affected = current_block.height;
+	}
+	remove_current_block_from_board_display();
+	current_block = tmp_block;
+	add_current_block_to_board_display();
+	
+	update_rows_on_display(current_block.row, rows_affected);
+	remove_ghost_block();
+	spawn_ghost_block();
+	return 1;
+}
+
 /*
  * Add current block to board at its current position. We do this using a
  * bitwise OR for each row that contains the block.	No display update is
@@ -293,6 +365,7 @@ uint8_t attempt_rotation(void) {
  * If this suceeds, we return 1, otherwise we return 0 (meaning game over).
  */
 uint8_t fix_block_to_board_and_add_new_block(void) {
+	telemetry_lock(current_block);
 	for(uint8_t row = 0; row < current_block.height; row++) {
 		uint8_t board_row = current_block.row + row;
 		board[board_row] |= 
@@ -303,6 +376,76 @@ uint8_t fix_block_to_board_and_add_new_block(void) {
 	return add_random_block();
 }
 
+/*
+ * Drop the current block by one row or, if it can't drop any further, fix
+ * it to the board and add a new block. Returns 0 if the new block could
+ * not be added (game over), 1 otherwise.
+ */
+uint8_t drop_or_fix_block(void) {
+	if(attempt_drop_block_one_row()) {
+		return 1;
+	}
+	return fix_block_to_board_and_add_new_block();
+}
+
+/*
+ * Drop the current block as far as it will go, scoring a point for each
+ * row, then fix it to the board and add a new block. Returns 0 if the new
+ * block could not be added (game over), 1 otherwise.
+ */
+uint8_t hard_drop_block(void) {
+	// Find where the block lands, then move it there in one go
+	FallingBlock tmp_block = current_block;
+	uint8_t start_row = current_block.row;
+	
+	while(tmp_block.row + tmp_block.height < BOARD_ROWS) {
+		tmp_block.row += 1;
+		if(block_collides(tmp_block)) {
+			tmp_block.row -= 1;
+			break;
+		}
+	}
+	if(tmp_block.row != start_row) {
+		remove_current_block_from_board_display();
+		current_block = tmp_block;
+		add_current_block_to_board_display();
+		update_rows_on_display(start_row,
+				current_block.row - start_row + current_block.height);
+		add_to_score(current_block.row - start_row);
+	}
+	return fix_block_to_board_and_add_new_block();
+}
+
+/*
+ * Time between drops (ms) - 600ms to start with, getting faster as rows
+ * are cleared.
+ */
+uint16_t get_drop_interval(void) {
+	if (get_row_count() < 30) {
+		return 600 - (get_row_count()*20);
+	}
+	return 20;
+}
+
+void get_game_state(uint8_t* state) {
+	uint32_t score = get_score();
+	
+	for(uint8_t row = 0; row < BOARD_ROWS; row++) {
+		state[row] = board[row];
+	}
+	state[16] = current_block.blocknum;
+	state[17] = current_block.rotation;
+	state[18] = current_block.row;
+	state[19] = current_block.column;
+	state[20] = next_block.blocknum;
+	state[21] = next_block.rotation;
+	state[22] = score;
+	state[23] = score >> 8;
+	state[24] = score >> 16;
+	state[25] = score >> 24;
+	state[26] = get_row_count();
+}
+
 //////////////////////////////////////////////////////////////////////////
 // Internal functions below
 //////////////////////////////////////////////////////////////////////////
@@ -327,8 +470,9 @@ static void check_for_completed_rows(int scoring_combo) {
 				}
 			}
 			board[0] = 0;
-			set_matrix_column_to_colour(0,0x00);
+			set_matrix_column_to_colour(board_display[0], 0x00);
 			ledmatrix_update_all(board_display);
+			terminal_remove_row(i);
 			row_complete = 1;
 			break;
 		}
@@ -408,6 +552,7 @@ static uint8_t add_random_block(void) {
 	
 	// Update the display for the rows which are affected
 	update_rows_on_display(current_block.row, current_block.height);
+	telemetry_spawn(current_block, next_block);
 	
 	spawn_ghost_block();
 	
@@ -436,6 +581,25 @@ static uint8_t block_collides(FallingBlock block) {
 	return 0;	// No collisions detected
 }
 
+/*
+ * Return a copy of the current block with the given rotation and column
+ */
+static FallingBlock block_in_position(uint8_t rotation, uint8_t column) {
+	FallingBlock block = current_block;
+	
+	block.rotation = rotation;
+	block.column = column;
+	block.pattern = block_library[block.blocknum].patterns[rotation];
+	if(rotation % 2 == 0) {
+		block.height = block_library[block.blocknum].height;
+		block.width = block_library[block.blocknum].width;
+	} else {
+		block.height = block_library[block.blocknum].width;
+		block.width = block_library[block.blocknum].height;
+	}
+	return block;
+}
+
 /*
  * Remove the current block from the display structure
  */
@@ -475,6 +639,10 @@ static void add_current_block_to_board_display(void) {
 
 void fast_terminal_draw(void) {
 	terminal_draw(board_display);
+	if(telemetry_update(board_display, board, next_block)) {
+		// Not everything could be sent - try again next refresh
+		terminal_board_changed();
+	}
 }
 
 void save_game(void) {
@@ -513,6 +681,8 @@ void load_game(void) {
 		set_row_count(cleared_row_count);
 		//update game views
 		ledmatrix_update_all(board_display);
+		terminal_board_changed();
+		telemetry_board_replaced();
 		draw_next_block(next_block);
 		//board
 		for (uint8_t i = 0; i < 16; i++) {
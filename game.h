@@ -57,6 +57,13 @@ uint8_t attempt_drop_ghost_one_row(void);
  */
 uint8_t attempt_rotation(void);
 
+/*
+ * Move the current block to the given rotation (0 to 3) and column in one
+ * step, if it could get there by moving and rotating in its current row.
+ * Returns 1 on success, 0 if the position can't be reached.
+ */
+uint8_t attempt_placement(uint8_t rotation, uint8_t column);
+
 /*
  * Fix the current block to the board in its current position
  * and add another random block to the top. Returns 0 on failure
@@ -64,6 +71,31 @@ uint8_t attempt_rotation(void);
  */
 uint8_t fix_block_to_board_and_add_new_block(void);
 
+/*
+ * Drop the current block by one row, or fix it to the board and add a
+ * new block if it can't drop. Returns 0 if the game is over, 1 otherwise.
+ */
+uint8_t drop_or_fix_block(void);
+
+/*
+ * Drop the current block as far as it will go (a point per row), fix it
+ * to the board and add a new block. Returns 0 if the game is over, 1
+ * otherwise.
+ */
+uint8_t hard_drop_block(void);
+
+/*
+ * Return the time (ms) between drops of the falling block, which
+ * depends on the number of rows cleared.
+ */
+uint16_t get_drop_interval(void);
+
+/*
+ * Copy the game state into state (HOSTCTL_STATE_SIZE bytes in the
+ * format given in hostctl.h).
+ */
+void get_game_state(uint8_t* state);
+
 void fast_terminal_draw(void);
 
 void load_game(void);
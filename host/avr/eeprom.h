@@ -0,0 +1,31 @@
+/*
+ * avr/eeprom.h (host stand-in) - see io.h. The EEPROM is always blank
+ * (reads as 0xFF) and writes are thrown away.
+ */
+
+#ifndef HOST_AVR_EEPROM_H_
+#define HOST_AVR_EEPROM_H_
+
+#include <stdint.h>
+
+static inline uint8_t eeprom_read_byte(const uint8_t* address) {
+	(void)address;
+	return 0xFF;
+}
+
+static inline uint32_t eeprom_read_dword(const uint32_t* address) {
+	(void)address;
+	return 0xFFFFFFFF;
+}
+
+static inline void eeprom_write_byte(uint8_t* address, uint8_t value) {
+	(void)address;
+	(void)value;
+}
+
+static inline void eeprom_write_dword(uint32_t* address, uint32_t value) {
+	(void)address;
+	(void)value;
+}
+
+#endif /* HOST_AVR_EEPROM_H_ */
@@ -0,0 +1,16 @@
+/*
+ * avr/interrupt.h (host stand-in) - see io.h. Interrupt handlers are
+ * ordinary functions, called by the host program when it wants them to
+ * run (so it never needs to disable them).
+ */
+
+#ifndef HOST_AVR_INTERRUPT_H_
+#define HOST_AVR_INTERRUPT_H_
+
+#include <avr/io.h>
+
+#define ISR(vector) void vector(void)
+#define cli()
+#define sei()
+
+#endif /* HOST_AVR_INTERRUPT_H_ */
@@ -0,0 +1,54 @@
+/*
+ * avr/io.h (host stand-in)
+ *
+ * Just enough of avr-libc for host programs which compile the game's own
+ * source files (see terminal_replay.c). The I/O registers are plain
+ * variables, so each program must be a single translation unit. Only the
+ * registers and bits those files use are here.
+ */
+
+#ifndef HOST_AVR_IO_H_
+#define HOST_AVR_IO_H_
+
+#include <stdint.h>
+
+#define _BV(bit) (1 << (bit))
+#define bit_is_set(reg, bit) ((reg) & _BV(bit))
+#define bit_is_clear(reg, bit) (!((reg) & _BV(bit)))
+
+static volatile uint8_t SREG = 0x80;	// interrupts on
+#define SREG_I 7
+
+static volatile uint8_t DDRB, PORTB, DDRD, PIND;
+
+// USART 0
+static volatile uint8_t UCSR0A, UCSR0B, UCSR0C, UDR0;
+static volatile uint16_t UBRR0;
+#define MPCM0 0
+#define U2X0 1
+#define UPE0 2
+#define DOR0 3
+#define FE0 4
+#define UDRE0 5
+#define TXC0 6
+#define RXC0 7
+#define TXB80 0
+#define RXB80 1
+#define UCSZ02 2
+#define TXEN0 3
+#define RXEN0 4
+#define UDRIE0 5
+#define TXCIE0 6
+#define RXCIE0 7
+
+// SPI 0 - transfers complete straight away
+static volatile uint8_t SPCR0, SPDR0;
+static volatile uint8_t SPSR0 = 0x80;
+#define SPR00 0
+#define SPR10 1
+#define MSTR0 4
+#define SPE0 6
+#define SPI2X0 0
+#define SPIF0 7
+
+#endif /* HOST_AVR_IO_H_ */
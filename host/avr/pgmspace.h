@@ -0,0 +1,28 @@
+/*
+ * avr/pgmspace.h (host stand-in) - see io.h. Program memory is ordinary
+ * memory, so the _P functions are the normal ones. (pgm_read_word() is
+ * also used to read pointers, so it reads whatever type it is given.)
+ */
+
+#ifndef HOST_AVR_PGMSPACE_H_
+#define HOST_AVR_PGMSPACE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(address) (*(const uint8_t*)(address))
+#define pgm_read_word(address) (*(address))
+#define pgm_read_dword(address) (*(address))
+#define strlen_P strlen
+#define memcpy_P memcpy
+#define fputs_P fputs
+#define printf_P printf
+
+// From avr-libc's stdio.h, which serialio.c relies on
+#define FDEV_SETUP_STREAM(put, get, rwflag) { 0 }
+#define _FDEV_SETUP_RW 3
+
+#endif /* HOST_AVR_PGMSPACE_H_ */
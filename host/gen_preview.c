@@ -0,0 +1,142 @@
+/*
+ * gen_preview.c
+ *
+ * Host program which generates next_block_preview.h - the escape sequences
+ * which draw the "next block" preview on the terminal, one for each block
+ * and rotation in the block library. The sequences are stored in flash on
+ * the AVR so a preview can be drawn a row at a time straight from flash.
+ *
+ * Rebuild the header whenever blocks.h or the preview layout changes:
+ *     cc -o gen_preview host/gen_preview.c
+ *     ./gen_preview > next_block_preview.h
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "../blocks.h"
+
+// Top left corner of the preview area on the terminal and its size
+#define PREVIEW_X 20
+#define PREVIEW_Y 10
+#define PREVIEW_SIZE 5
+
+// SGR state as we build a sequence: -1 unknown, 0 normal, otherwise the
+// (reverse video) colour code
+static int sgr_state;
+
+// Convert a block colour to the colour code used for the preview.
+// (Must match the colours the preview has always been drawn with.)
+static int preview_colour_code(uint8_t colour) {
+	switch(colour) {
+		case COLOUR_RED : return 31;
+		case COLOUR_GREEN : return 32;
+		case COLOUR_YELLOW : return 33;
+		case COLOUR_ORANGE : return 34;
+		case COLOUR_LIGHT_ORANGE : return 35;
+		case COLOUR_LIGHT_YELLOW : return 36;
+		case COLOUR_LIGHT_GREEN : return 37;
+		default: return 30;
+	}
+}
+
+static void set_sgr(char* out, int code) {
+	char seq[16];
+	if(code == sgr_state) {
+		return;
+	}
+	if(code == 0) {
+		strcpy(seq, "\\x1b[0m");
+	} else if(sgr_state > 0) {
+		sprintf(seq, "\\x1b[%dm", code);
+	} else if(sgr_state == 0) {
+		sprintf(seq, "\\x1b[7;%dm", code);
+	} else {
+		sprintf(seq, "\\x1b[0;7;%dm", code);
+	}
+	strcat(out, seq);
+	sgr_state = code;
+}
+
+static void build_preview(char* out, int blocknum, int rotation) {
+	const BlockInfo* info = &block_library[blocknum];
+	const rowtype* pattern = info->patterns[rotation];
+	int height = (rotation % 2 == 0) ? info->height : info->width;
+	int width = (rotation % 2 == 0) ? info->width : info->height;
+	int colour = preview_colour_code(info->colour);
+	
+	out[0] = '\0';
+	for(int row = 0; row < PREVIEW_SIZE; row++) {
+		if(row > 0) {
+			// Row separator - the AVR moves the cursor to the next row
+			strcat(out, "\\n");
+		}
+		// Each row starts (and ends) in normal display mode
+		sgr_state = 0;
+		// Block is drawn from the left of the area - the highest
+		// column bit of the pattern is on the left
+		for(int col = width - 1; col >= width - PREVIEW_SIZE; col--) {
+			if(row >= height || col < 0) {
+				set_sgr(out, 0);
+			} else if(pattern[row] & (1 << col)) {
+				set_sgr(out, colour);
+			} else {
+				set_sgr(out, 30);
+			}
+			strcat(out, " ");
+		}
+		set_sgr(out, 0);
+	}
+}
+
+int main(void) {
+	static char previews[NUM_BLOCKS_IN_LIBRARY][NUM_ROTATIONS][512];
+	
+	printf("/*\n * next_block_preview.h\n *\n");
+	printf(" * GENERATED by host/gen_preview.c from blocks.h - do not edit.\n *\n");
+	printf(" * Escape sequences which draw the next block preview (a %dx%d area\n", 
+			PREVIEW_SIZE, PREVIEW_SIZE);
+	printf(" * with its top left corner at column %d, row %d) for each block and\n",
+			PREVIEW_X, PREVIEW_Y);
+	printf(" * rotation. Rows are separated by '\\n' - the cursor must be moved to\n");
+	printf(" * the start of each row and the terminal put in normal display mode\n");
+	printf(" * before the row is sent. Each row leaves normal display mode set.\n */\n\n");
+	printf("#ifndef NEXT_BLOCK_PREVIEW_H_\n#define NEXT_BLOCK_PREVIEW_H_\n\n");
+	printf("#include <avr/pgmspace.h>\n#include \"blocks.h\"\n\n");
+	printf("#define PREVIEW_X %d\n#define PREVIEW_Y %d\n#define PREVIEW_SIZE %d\n\n",
+			PREVIEW_X, PREVIEW_Y, PREVIEW_SIZE);
+	
+	for(int b = 0; b < NUM_BLOCKS_IN_LIBRARY; b++) {
+		for(int r = 0; r < NUM_ROTATIONS; r++) {
+			build_preview(previews[b][r], b, r);
+			// Rotations which look the same share a string
+			int duplicate = 0;
+			for(int prev = 0; prev < r; prev++) {
+				if(strcmp(previews[b][prev], previews[b][r]) == 0) {
+					duplicate = 1;
+				}
+			}
+			if(!duplicate) {
+				printf("static const char preview_%d_%d[] PROGMEM =\n\t\"%s\";\n",
+						b, r, previews[b][r]);
+			}
+		}
+	}
+	printf("\nstatic const char* const preview_strings[NUM_BLOCKS_IN_LIBRARY][NUM_ROTATIONS] PROGMEM = {\n");
+	for(int b = 0; b < NUM_BLOCKS_IN_LIBRARY; b++) {
+		printf("\t{ ");
+		for(int r = 0; r < NUM_ROTATIONS; r++) {
+			int first = r;
+			for(int prev = r - 1; prev >= 0; prev--) {
+				if(strcmp(previews[b][prev], previews[b][r]) == 0) {
+					first = prev;
+				}
+			}
+			printf("preview_%d_%d%s", b, first, (r < NUM_ROTATIONS - 1) ? ", " : "");
+		}
+		printf(" }%s\n", (b < NUM_BLOCKS_IN_LIBRARY - 1) ? "," : "");
+	}
+	printf("};\n\n#endif /* NEXT_BLOCK_PREVIEW_H_ */\n");
+	return 0;
+}
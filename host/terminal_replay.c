@@ -0,0 +1,476 @@
+/*
+ * terminal_replay.c
+ *
+ * Measures how many bytes the terminal display takes. Random games (from a
+ * fixed seed, so runs can be compared) are played through the game's own
+ * game, terminal and serial code for the given time, with the UART
+ * modelled as sending a fixed number of bytes every
+ * TERMINAL_REFRESH_INTERVAL ms (38 is 19200 baud). For each terminal
+ * update (frame) we count the bytes it put in the serial output buffer.
+ * Everything the UART sends is fed to a small model of the terminal, and
+ * at the end the board, its border, the score and the next block preview
+ * on the model's screen are checked against the game. The bytes for a
+ * full repaint of the final board are shown too.
+ *
+ * The AVR headers come from host/avr (just enough of them for the files
+ * compiled here). Define TERMINAL_REP_MODE (see terminalio.h) to compare
+ * drawing with and without run encoding - the probe isn't run, so
+ * TERMINAL_REP_PROBE means off.
+ *
+ * Build and run:
+ *     cc -Ihost -DTERMINAL_REP_MODE=0 -o terminal_replay host/terminal_replay.c
+ *     ./terminal_replay [seconds [seed [bytes per refresh]]]
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "../serialio.c"
+#include "../terminalio.c"
+#include "../game.c"
+#include "../blocks.c"
+#include "../score.c"
+#include "../telemetry.c"
+#include "../ledmatrix.c"
+#include "../spi.c"
+
+// Game time (ms)
+static uint32_t now;
+
+uint32_t get_clock_ticks(void) {
+	return now;
+}
+
+// Seven segment display and sound - not modelled (apart from the rows
+// cleared count, which telemetry reads back)
+static uint8_t rows_cleared;
+
+void set_row_count(uint8_t row_count) {
+	rows_cleared = row_count;
+}
+
+uint8_t get_row_count(void) {
+	return rows_cleared;
+}
+
+void play_game_tone(uint8_t tone_number) {
+	(void)tone_number;
+}
+
+void switch_to_game_over(uint8_t game_mode) {
+	(void)game_mode;
+}
+
+/*
+ * Terminal model. Each cell holds its character and the colour (0-7) it
+ * shows - the background colour, or the foreground colour in reverse
+ * video. The default colours are white on black.
+ */
+#define SCREEN_WIDTH 80
+#define SCREEN_HEIGHT 30
+#define MAX_PARAMS 4
+
+typedef struct {
+	char c;
+	uint8_t colour;
+} Cell;
+
+typedef struct {
+	Cell cells[SCREEN_HEIGHT][SCREEN_WIDTH];
+	int x, y;						// cursor (from 0)
+	int reverse, fg, bg;			// SGR state (colours 0-7)
+	int top, bottom;				// scroll region rows (from 0)
+	char last;						// last character printed (for REP)
+	int state;						// 0 normal, 1 after ESC, 2 in CSI
+	int private_mode;				// CSI started with '?'
+	int params[MAX_PARAMS];
+	int num_params;
+} Terminal;
+
+static Terminal screen;
+
+static Cell blank_cell(Terminal* t) {
+	Cell cell = { ' ', t->bg };
+	return cell;
+}
+
+static void term_reset(Terminal* t) {
+	memset(t, 0, sizeof(*t));
+	t->fg = 7;
+	t->bottom = SCREEN_HEIGHT - 1;
+	for(int y = 0; y < SCREEN_HEIGHT; y++) {
+		for(int x = 0; x < SCREEN_WIDTH; x++) {
+			t->cells[y][x] = blank_cell(t);
+		}
+	}
+}
+
+static void term_print(Terminal* t, char c) {
+	if(t->x >= SCREEN_WIDTH) {
+		t->x = SCREEN_WIDTH - 1;
+	}
+	t->cells[t->y][t->x].c = c;
+	t->cells[t->y][t->x].colour = t->reverse ? t->fg : t->bg;
+	t->last = c;
+	t->x++;
+}
+
+// Scroll the scroll region up (direction 1) or down (-1) one line
+static void term_scroll(Terminal* t, int direction) {
+	if(direction > 0) {
+		memmove(t->cells[t->top], t->cells[t->top + 1],
+				(t->bottom - t->top) * sizeof(t->cells[0]));
+	} else {
+		memmove(t->cells[t->top + 1], t->cells[t->top],
+				(t->bottom - t->top) * sizeof(t->cells[0]));
+	}
+	int row = (direction > 0) ? t->bottom : t->top;
+	for(int x = 0; x < SCREEN_WIDTH; x++) {
+		t->cells[row][x] = blank_cell(t);
+	}
+}
+
+static int term_param(Terminal* t, int i, int missing) {
+	return (i < t->num_params && t->params[i]) ? t->params[i] : missing;
+}
+
+static void term_sgr(Terminal* t) {
+	if(t->num_params == 0) {
+		t->num_params = 1;
+		t->params[0] = 0;
+	}
+	for(int i = 0; i < t->num_params; i++) {
+		int p = t->params[i];
+		if(p == 0) {
+			t->reverse = 0;
+			t->fg = 7;
+			t->bg = 0;
+		} else if(p == 7) {
+			t->reverse = 1;
+		} else if(p >= 30 && p <= 37) {
+			t->fg = p - 30;
+		} else if(p >= 40 && p <= 47) {
+			t->bg = p - 40;
+		}
+	}
+}
+
+static void term_csi(Terminal* t, char final) {
+	int n = term_param(t, 0, 1);
+
+	if(t->private_mode) {
+		return;		// cursor on/off
+	}
+	switch(final) {
+		case 'H':
+			t->y = term_param(t, 0, 1) - 1;
+			t->x = term_param(t, 1, 1) - 1;
+			break;
+		case 'A':
+			t->y -= n;
+			break;
+		case 'B':
+			t->y += n;
+			break;
+		case 'C':
+			t->x += n;
+			break;
+		case 'D':
+			t->x -= n;
+			break;
+		case 'J':
+			for(int y = 0; y < SCREEN_HEIGHT; y++) {
+				for(int x = 0; x < SCREEN_WIDTH; x++) {
+					t->cells[y][x] = blank_cell(t);
+				}
+			}
+			break;
+		case 'K':
+			for(int x = t->x; x < SCREEN_WIDTH; x++) {
+				t->cells[t->y][x] = blank_cell(t);
+			}
+			break;
+		case 'X':
+			for(int x = t->x; x < t->x + n && x < SCREEN_WIDTH; x++) {
+				t->cells[t->y][x] = blank_cell(t);
+			}
+			break;
+		case 'b':
+			while(n--) {
+				term_print(t, t->last);
+			}
+			break;
+		case 'm':
+			term_sgr(t);
+			break;
+		case 'r':
+			t->top = term_param(t, 0, 1) - 1;
+			t->bottom = term_param(t, 1, SCREEN_HEIGHT) - 1;
+			t->x = 0;
+			t->y = 0;
+			break;
+		case 'n':
+			break;		// cursor position request - no one to reply to
+		default:
+			fprintf(stderr, "unknown sequence ESC[%c\n", final);
+			exit(1);
+	}
+}
+
+static void term_feed(Terminal* t, char c) {
+	switch(t->state) {
+		case 0:
+			if(c == '\x1b') {
+				t->state = 1;
+			} else if(c == '\r') {
+				t->x = 0;
+			} else if(c == '\n') {
+				if(t->y == t->bottom) {
+					term_scroll(t, 1);
+				} else {
+					t->y++;
+				}
+			} else {
+				term_print(t, c);
+			}
+			break;
+		case 1:
+			t->state = 0;
+			if(c == '[') {
+				t->state = 2;
+				t->private_mode = 0;
+				t->num_params = 0;
+				memset(t->params, 0, sizeof(t->params));
+			} else if(c == 'M') {
+				// Reverse index
+				if(t->y == t->top) {
+					term_scroll(t, -1);
+				} else {
+					t->y--;
+				}
+			} else if(c == 'D') {
+				// Index
+				if(t->y == t->bottom) {
+					term_scroll(t, 1);
+				} else {
+					t->y++;
+				}
+			}
+			break;
+		default:
+			if(c == '?') {
+				t->private_mode = 1;
+			} else if(c >= '0' && c <= '9') {
+				if(t->num_params == 0) {
+					t->num_params = 1;
+				}
+				t->params[t->num_params - 1] =
+						t->params[t->num_params - 1] * 10 + (c - '0');
+			} else if(c == ';') {
+				if(t->num_params == 0) {
+					t->num_params = 1;
+				}
+				if(t->num_params < MAX_PARAMS) {
+					t->num_params++;
+				}
+			} else {
+				term_csi(t, c);
+				t->state = 0;
+			}
+			break;
+	}
+}
+
+// Let the UART send up to n bytes to the terminal. Returns the number sent.
+static long uart_send(long n) {
+	long sent = 0;
+
+	while(sent < n && out_head != out_tail) {
+		USART0_UDRE_vect();
+		term_feed(&screen, UDR0);
+		sent++;
+	}
+	return sent;
+}
+
+/*
+ * stdout (used for the game window and the like) goes to the serial
+ * module as it does on the board. When blocking we wait (for the UART)
+ * for room in the output buffer.
+ */
+static ssize_t serial_cookie_write(void* cookie, const char* data,
+		size_t length) {
+	(void)cookie;
+	for(size_t i = 0; i < length; i++) {
+		if(output_policy == SERIAL_OUTPUT_BLOCK) {
+			while(serial_output_space() < 2) {
+				uart_send(1);
+			}
+		}
+		uart_put_char(data[i], stdout);
+	}
+	return length;
+}
+
+// As project.c does when a game starts or the terminal needs redrawing
+static void redraw_terminal(void) {
+	serial_set_output_policy(SERIAL_OUTPUT_BLOCK);
+	clear_terminal();
+	hide_cursor();
+	display_score(get_score());
+	draw_game_window();
+	initial_display_next_block();
+	serial_set_output_policy(SERIAL_OUTPUT_DROP);
+}
+
+static void new_game(void) {
+	init_game();
+	init_score();
+	redraw_terminal();
+}
+
+// Send everything the terminal is waiting for
+static void finish_drawing(void) {
+	uart_send(100000);
+	while(terminal_refresh_pending()) {
+		fast_terminal_draw();
+		uart_send(100000);
+	}
+}
+
+// Count the cells which differ from what the game says is there
+static int check_screen(void) {
+	int errors = 0;
+
+	for(int row = 0; row < BOARD_ROWS; row++) {
+		Cell* line = screen.cells[BOARD_TERM_Y + row - 1];
+		for(int col = 0; col < BOARD_WIDTH; col++) {
+			Cell cell = line[BOARD_TERM_X + col - 1];
+			uint8_t wanted =
+					board_colour_code(board_display[row][col]) - FG_BLACK;
+			if(cell.c != ' ' || cell.colour != wanted) {
+				errors++;
+			}
+		}
+		if(line[BOARD_TERM_X - 2].c != '#' ||
+				line[BOARD_TERM_X + BOARD_WIDTH - 1].c != '#') {
+			errors++;
+		}
+	}
+
+	char score[32];
+	snprintf(score, sizeof(score), "Score: %10lu", (unsigned long)get_score());
+	for(int i = 0; score[i]; i++) {
+		if(screen.cells[2][2 + i].c != score[i]) {
+			errors++;
+			break;
+		}
+	}
+
+	// Draw the preview on a blank model and compare
+	static Terminal preview;
+	const char* text = preview_strings[next_block.blocknum][next_block.rotation];
+	term_reset(&preview);
+	for(int row = 0; row < PREVIEW_SIZE; row++) {
+		preview.x = PREVIEW_X - 1;
+		preview.y = PREVIEW_Y + row - 1;
+		while(*text && *text != '\n') {
+			term_feed(&preview, *text++);
+		}
+		if(*text) {
+			text++;
+		}
+		term_feed(&preview, '\x1b');
+		term_feed(&preview, '[');
+		term_feed(&preview, 'm');
+	}
+	for(int y = PREVIEW_Y - 1; y < PREVIEW_Y - 1 + PREVIEW_SIZE; y++) {
+		for(int x = PREVIEW_X - 1; x < PREVIEW_X - 1 + PREVIEW_SIZE; x++) {
+			if(screen.cells[y][x].colour != preview.cells[y][x].colour) {
+				errors++;
+			}
+		}
+	}
+	return errors;
+}
+
+int main(int argc, char** argv) {
+	uint32_t seconds = (argc > 1) ? atol(argv[1]) : 600;
+	unsigned int seed = (argc > 2) ? atoi(argv[2]) : 7;
+	long bytes_per_refresh = (argc > 3) ? atol(argv[3]) : 38;
+	long frames = 0, frame_bytes = 0, max_frame = 0;
+	long games = 0, resyncs = 0, repaint = 0;
+	cookie_io_functions_t serial_functions = { NULL, serial_cookie_write,
+		NULL, NULL };
+
+	stdout = fopencookie(NULL, "w", serial_functions);
+	setvbuf(stdout, NULL, _IONBF, 0);
+	term_reset(&screen);
+	srandom(seed);
+	new_game();
+
+	for(now = 0; now < seconds * 1000; now += TERMINAL_REFRESH_INTERVAL) {
+		// A button push now and then. The block drops every 400ms, or
+		// sooner if it's pushed down.
+		int action = random() % 12;
+		if(action == 0) {
+			attempt_move(MOVE_LEFT);
+		} else if(action == 1) {
+			attempt_move(MOVE_RIGHT);
+		} else if(action == 2) {
+			attempt_rotation();
+		}
+		if(action == 3 || now % 400 == 0) {
+			if(!drop_or_fix_block()) {
+				games++;
+				new_game();
+			}
+		}
+
+		if(terminal_resync_needed()) {
+			resyncs++;
+			redraw_terminal();
+		}
+		uart_send(bytes_per_refresh);
+		if(terminal_refresh_pending()) {
+			uint8_t head = out_head;
+			fast_terminal_draw();
+			long bytes = (uint8_t)(out_head - head);
+			if(bytes) {
+				frames++;
+				frame_bytes += bytes;
+				if(bytes > max_frame) {
+					max_frame = bytes;
+				}
+			}
+		}
+	}
+
+	finish_drawing();
+	int errors = check_screen();
+
+	// Repaint the final board from a cleared screen
+	redraw_terminal();
+	uart_send(100000);
+	while(terminal_refresh_pending()) {
+		uint8_t head = out_head;
+		fast_terminal_draw();
+		repaint += (uint8_t)(out_head - head);
+		uart_send(100000);
+	}
+	errors += check_screen();
+
+	// (stdout is the serial port)
+	fprintf(stderr, "%lu s, %ld games, %ld redraws\n", (unsigned long)seconds,
+			games, resyncs);
+	fprintf(stderr, "%ld frames, %ld bytes, %.1f bytes/frame, max %ld\n",
+			frames, frame_bytes, frames ? (double)frame_bytes / frames : 0.0,
+			max_frame);
+	fprintf(stderr, "full repaint of the final board: %ld bytes\n", repaint);
+	fprintf(stderr, "screen %s (%d cells wrong)\n",
+			errors ? "DIFFERS" : "matches", errors);
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,409 @@
+/*
+ * tetris_bot.c
+ *
+ * Host (Linux) bot which plays the game through the host control protocol
+ * (see hostctl.h). It starts a lockstep game, then for each block picks
+ * a placement (lowest resulting stack, fewest holes) and sends a PLACE
+ * command for it, which gets the block there and drops it in one round
+ * trip. We work out what the board should look like afterwards and count
+ * a desync if the game's board differs.
+ *
+ * With -m the bot sends the rotations, moves and drop one at a time
+ * instead (as a person at the terminal would), checking the state hash
+ * in each reply against what we expect the state to be.
+ *
+ * Build and run:
+ *     cc -o tetris_bot host/tetris_bot.c
+ *     ./tetris_bot [-m] /dev/ttyUSB0 19200 [seed] [games]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <time.h>
+#include <sys/select.h>
+
+#include "../blocks.h"
+#include "../hostctl.h"
+#include "../input.h"
+
+#define REPLY_TIMEOUT_MS 250
+#define MAX_ATTEMPTS 8
+
+typedef struct {
+	uint8_t status;
+	uint16_t hash;
+} Reply;
+
+static int fd;
+static uint8_t sequence;
+static int use_moves;
+// Game state from the last reply which had one
+static uint8_t state[HOSTCTL_STATE_SIZE];
+static unsigned long commands, retries, desyncs, crc_errors;
+
+static speed_t baud_constant(long baud) {
+	switch(baud) {
+		case 9600: return B9600;
+		case 19200: return B19200;
+		case 38400: return B38400;
+		case 57600: return B57600;
+		case 115200: return B115200;
+		case 230400: return B230400;
+#ifdef B250000
+		case 250000: return B250000;
+#endif
+		default:
+			fprintf(stderr, "Unsupported baud rate %ld\n", baud);
+			exit(1);
+	}
+}
+
+static int open_serial(const char* device, long baud) {
+	struct termios tio;
+	int fd = open(device, O_RDWR | O_NOCTTY);
+	if(fd < 0) {
+		perror(device);
+		exit(1);
+	}
+	tcgetattr(fd, &tio);
+	// Raw, and no XON/XOFF - replies can contain those bytes. (We only
+	// ever have one command outstanding so can't overrun the game.)
+	cfmakeraw(&tio);
+	cfsetispeed(&tio, baud_constant(baud));
+	cfsetospeed(&tio, baud_constant(baud));
+	tio.c_cc[VMIN] = 0;
+	tio.c_cc[VTIME] = 0;
+	tcsetattr(fd, TCSANOW, &tio);
+	return fd;
+}
+
+static uint16_t state_hash(const uint8_t* state) {
+	uint16_t hash = 0xFFFF;
+	for(int i = 0; i < HOSTCTL_STATE_SIZE; i++) {
+		hash = hostctl_crc16(hash, state[i]);
+	}
+	return hash;
+}
+
+static void send_frame(uint8_t type, const uint8_t* payload, uint8_t length) {
+	uint8_t frame[HOSTCTL_HEADER_SIZE + HOSTCTL_MAX_PAYLOAD + 1];
+	uint8_t crc = 0;
+
+	frame[0] = HOSTCTL_SYNC;
+	frame[1] = type;
+	frame[2] = sequence;
+	frame[3] = length;
+	memcpy(frame + HOSTCTL_HEADER_SIZE, payload, length);
+	for(int i = 1; i < HOSTCTL_HEADER_SIZE + length; i++) {
+		crc = telemetry_crc8(crc, frame[i]);
+	}
+	frame[HOSTCTL_HEADER_SIZE + length] = crc;
+	if(write(fd, frame, HOSTCTL_HEADER_SIZE + length + 1) < 0) {
+		perror("write");
+		exit(1);
+	}
+}
+
+/*
+ * Wait for the reply to the command with the current sequence number.
+ * Everything else (terminal output, replies to earlier commands) is
+ * skipped. Returns 0 on timeout.
+ */
+static int read_reply(uint8_t type, Reply* reply) {
+	uint8_t frame[HOSTCTL_HEADER_SIZE + 256 + 1];
+	int have = 0;
+	uint8_t byte;
+
+	while(1) {
+		fd_set fds;
+		struct timeval timeout = { 0, REPLY_TIMEOUT_MS * 1000 };
+		FD_ZERO(&fds);
+		FD_SET(fd, &fds);
+		if(select(fd + 1, &fds, NULL, NULL, &timeout) <= 0) {
+			return 0;
+		}
+		while(read(fd, &byte, 1) == 1) {
+			if(have == 0 && byte != HOSTCTL_SYNC) {
+				continue;
+			}
+			frame[have++] = byte;
+			if(have < HOSTCTL_HEADER_SIZE ||
+					have < HOSTCTL_HEADER_SIZE + frame[3] + 1) {
+				continue;
+			}
+			uint8_t crc = 0;
+			for(int i = 1; i < have - 1; i++) {
+				crc = telemetry_crc8(crc, frame[i]);
+			}
+			have = 0;
+			if(crc != frame[HOSTCTL_HEADER_SIZE + frame[3]]) {
+				crc_errors++;
+				continue;
+			}
+			if(frame[1] != (type | HOSTCTL_REPLY) || frame[2] != sequence ||
+					frame[3] < HOSTCTL_REPLY_HEADER) {
+				continue;
+			}
+			reply->status = frame[4];
+			reply->hash = frame[5] | (frame[6] << 8);
+			if(frame[3] >= HOSTCTL_REPLY_HEADER + HOSTCTL_STATE_SIZE) {
+				memcpy(state, frame + 7, HOSTCTL_STATE_SIZE);
+			}
+			return 1;
+		}
+	}
+}
+
+// Send a command (again if need be) until it is acknowledged
+static void command(uint8_t type, const uint8_t* payload, uint8_t length,
+		Reply* reply) {
+	sequence++;
+	commands++;
+	for(int attempt = 0; attempt < MAX_ATTEMPTS; attempt++) {
+		send_frame(type, payload, length);
+		if(read_reply(type, reply)) {
+			if(reply->status != HOSTCTL_BUSY) {
+				return;
+			}
+			attempt--;	// busy isn't a failure - just try again
+			sequence++;
+		}
+		retries++;
+	}
+	fprintf(stderr, "No reply from the game\n");
+	exit(1);
+}
+
+/////////////////////////////// placement ///////////////////////////////
+
+static int block_height(int block, int rotation) {
+	return (rotation % 2 == 0) ? block_library[block].height :
+			block_library[block].width;
+}
+
+static int block_width(int block, int rotation) {
+	return (rotation % 2 == 0) ? block_library[block].width :
+			block_library[block].height;
+}
+
+static int collides(const uint8_t* board, int block, int rotation, int row,
+		int column) {
+	if(row + block_height(block, rotation) > TELEMETRY_BOARD_ROWS) {
+		return 1;
+	}
+	for(int r = 0; r < block_height(block, rotation); r++) {
+		if((block_library[block].patterns[rotation][r] << column) & board[row + r]) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Score the board we'd get by dropping the block at the given rotation
+ * and column from the top of the board (lower is better), or -1 if it
+ * can't be placed there. The board is left in result. The weights are the usual ones for total column
+ * height, holes, bumpiness (height differences between neighbouring
+ * columns) and rows cleared.
+ */
+static long evaluate(int block, int rotation, int column, uint8_t* board) {
+	int row = 0, height = 0, holes = 0, bumpiness = 0, lines = 0;
+	int last_height = -1;
+
+	if(column + block_width(block, rotation) > TELEMETRY_BOARD_WIDTH ||
+			collides(state, block, rotation, 0, column)) {
+		return -1;
+	}
+	memcpy(board, state, TELEMETRY_BOARD_ROWS);
+	while(!collides(board, block, rotation, row + 1, column)) {
+		row++;
+	}
+	for(int r = 0; r < block_height(block, rotation); r++) {
+		board[row + r] |= block_library[block].patterns[rotation][r] << column;
+		if(board[row + r] == (1 << TELEMETRY_BOARD_WIDTH) - 1) {
+			// Complete - move the rows above down
+			memmove(board + 1, board, row + r);
+			board[0] = 0;
+			lines++;
+		}
+	}
+	for(int col = 0; col < TELEMETRY_BOARD_WIDTH; col++) {
+		int top = TELEMETRY_BOARD_ROWS;
+		for(int r = 0; r < TELEMETRY_BOARD_ROWS; r++) {
+			if(board[r] & (1 << col)) {
+				if(top == TELEMETRY_BOARD_ROWS) {
+					top = r;
+				}
+			} else if(top < r) {
+				holes++;
+			}
+		}
+		height += TELEMETRY_BOARD_ROWS - top;
+		if(last_height >= 0) {
+			bumpiness += abs(last_height - (TELEMETRY_BOARD_ROWS - top));
+		}
+		last_height = TELEMETRY_BOARD_ROWS - top;
+	}
+	return height * 51 + holes * 36 + bumpiness * 18 - lines * 76 + 10000;
+}
+
+// Apply a rotation or move to our copy of the state, as the game would
+static void predict(uint8_t* state, uint8_t action) {
+	int block = state[16];
+	int rotation = state[17];
+	int column = state[19];
+
+	if(action == ACTION_ROTATE) {
+		state[17] = (rotation + 1) % 4;
+	} else if(action == ACTION_LEFT) {
+		state[19] = column + 1;
+	} else {
+		state[19] = column - 1;
+	}
+	if(state[19] + block_width(block, state[17]) > TELEMETRY_BOARD_WIDTH ||
+			collides(state, block, state[17], state[18], state[19])) {
+		state[17] = rotation;
+		state[19] = column;
+	}
+}
+
+/*
+ * Pick the best placement for the falling block. Returns the number of
+ * rotations needed to get to it, and sets the column and the board we
+ * expect afterwards.
+ */
+static int choose_placement(int* best_column, uint8_t* expected) {
+	uint8_t board[TELEMETRY_BOARD_ROWS];
+	long best = -1;
+	int best_turns = 0;
+	int block = state[16];
+
+	*best_column = state[19];
+	memcpy(expected, state, TELEMETRY_BOARD_ROWS);
+	for(int turns = 0; turns < 4; turns++) {
+		int rotation = (state[17] + turns) % 4;
+		for(int column = 0; column < TELEMETRY_BOARD_WIDTH; column++) {
+			long score = evaluate(block, rotation, column, board);
+			if(score >= 0 && (best < 0 || score < best)) {
+				best = score;
+				best_turns = turns;
+				*best_column = column;
+				memcpy(expected, board, TELEMETRY_BOARD_ROWS);
+			}
+		}
+	}
+	return best_turns;
+}
+
+// Play a block with one PLACE command. Returns 0 if the game ended.
+static int place_block(void) {
+	uint8_t expected[TELEMETRY_BOARD_ROWS];
+	uint8_t payload[3];
+	int column;
+	Reply reply;
+
+	payload[0] = (state[17] + choose_placement(&column, expected)) % 4;
+	payload[1] = column;
+	payload[2] = HOSTCTL_PLACE_DROP;
+	command(HOSTCTL_CMD_PLACE, payload, 3, &reply);
+	if(reply.status == HOSTCTL_FAILED) {
+		// Can't get there - drop it where it is
+		uint8_t action = ACTION_DROP;
+		command(HOSTCTL_CMD_ACTION, &action, 1, &reply);
+		command(HOSTCTL_CMD_QUERY, NULL, 0, &reply);
+		return reply.status != HOSTCTL_GAME_OVER;
+	}
+	if(reply.status == HOSTCTL_GAME_OVER) {
+		return 0;
+	}
+	if(memcmp(state, expected, TELEMETRY_BOARD_ROWS) != 0) {
+		desyncs++;
+	}
+	return 1;
+}
+
+// Play a block with single moves. Returns 0 if the game ended.
+static int move_block(void) {
+	uint8_t expected[TELEMETRY_BOARD_ROWS];
+	uint8_t predicted[HOSTCTL_STATE_SIZE];
+	uint8_t action;
+	int column;
+	Reply reply;
+
+	int turns = choose_placement(&column, expected);
+	memcpy(predicted, state, HOSTCTL_STATE_SIZE);
+	while(turns > 0 || predicted[19] != column) {
+		uint8_t before[HOSTCTL_STATE_SIZE];
+
+		action = turns > 0 ? ACTION_ROTATE :
+				predicted[19] < column ? ACTION_LEFT : ACTION_RIGHT;
+		memcpy(before, predicted, HOSTCTL_STATE_SIZE);
+		predict(predicted, action);
+		command(HOSTCTL_CMD_ACTION, &action, 1, &reply);
+		if(reply.status == HOSTCTL_GAME_OVER) {
+			return 0;
+		}
+		if(reply.hash != state_hash(predicted)) {
+			desyncs++;
+			break;
+		}
+		if(memcmp(before, predicted, HOSTCTL_STATE_SIZE) == 0) {
+			break;		// blocked - drop it where it is
+		}
+		if(action == ACTION_ROTATE) {
+			turns--;
+		}
+	}
+	action = ACTION_DROP;
+	command(HOSTCTL_CMD_ACTION, &action, 1, &reply);
+	command(HOSTCTL_CMD_QUERY, NULL, 0, &reply);
+	return reply.status != HOSTCTL_GAME_OVER;
+}
+
+int main(int argc, char* argv[]) {
+	struct timespec start, now;
+	unsigned long blocks = 0;
+	Reply reply;
+
+	if(argc > 1 && strcmp(argv[1], "-m") == 0) {
+		use_moves = 1;
+		argc--;
+		argv++;
+	}
+	if(argc < 2) {
+		fprintf(stderr, "Usage: %s [-m] device [baud [seed [games]]]\n",
+				argv[0]);
+		return 1;
+	}
+	uint32_t seed = (argc > 3) ? strtoul(argv[3], NULL, 0) : 1;
+	int games = (argc > 4) ? atoi(argv[4]) : 1;
+	fd = open_serial(argv[1], (argc > 2) ? atol(argv[2]) : 19200);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(int game = 0; game < games; game++, seed++) {
+		uint8_t payload[5] = { seed, seed >> 8, seed >> 16, seed >> 24,
+				HOSTCTL_LOCKSTEP };
+		unsigned long game_blocks = 0;
+
+		command(HOSTCTL_CMD_SEED, payload, 5, &reply);
+		command(HOSTCTL_CMD_QUERY, NULL, 0, &reply);
+		while(use_moves ? move_block() : place_block()) {
+			game_blocks++;
+		}
+		blocks += game_blocks;
+		printf("game %d (seed %u): %lu blocks, score %u, %u rows\n", game + 1,
+				seed, game_blocks, state[22] | (state[23] << 8) |
+				(state[24] << 16) | ((uint32_t)state[25] << 24),
+				state[26]);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	double seconds = (now.tv_sec - start.tv_sec) +
+			(now.tv_nsec - start.tv_nsec) / 1e9;
+	printf("%lu blocks in %.1fs (%.0f per minute), %lu commands, %lu retries,"
+			" %lu desyncs, %lu crc errors\n", blocks, seconds,
+			blocks * 60 / seconds, commands, retries, desyncs, crc_errors);
+	return 0;
+}
@@ -0,0 +1,324 @@
+/*
+ * tetris_spectate.c
+ *
+ * Host (Linux) spectator for the placement stream (see telemetry.h).
+ * The game only tells us where each block was locked and which block was
+ * added next; we place the blocks and clear completed rows ourselves to
+ * rebuild the board. Each KEYFRAME message is checked against our board -
+ * if they disagree (e.g. because a record was lost) we count a desync and
+ * take the board from the keyframe.
+ *
+ * Build and run:
+ *     cc -o tetris_spectate host/tetris_spectate.c
+ *     ./tetris_spectate /dev/ttyUSB0 19200
+ * Press 't' in the game's serial console until placement mode is selected.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+
+#include "../telemetry.h"
+
+#define UNKNOWN_COLOUR 0xFF
+
+typedef struct {
+	rowtype board[TELEMETRY_BOARD_ROWS];	// bit 0 is column 0 (on the right)
+	uint8_t colours[TELEMETRY_BOARD_ROWS][TELEMETRY_BOARD_WIDTH];
+	int falling_block, falling_rotation, falling_column;
+	int next_block, next_rotation;
+	uint32_t score;
+	unsigned lock_count;
+	unsigned long rows_cleared;
+	// Statistics
+	unsigned long bytes, records, keyframes, keyframes_ok, new_games,
+			crc_errors, lost, desyncs;
+	int last_sequence;
+} SpectateState;
+
+static speed_t baud_constant(long baud) {
+	switch(baud) {
+		case 9600: return B9600;
+		case 19200: return B19200;
+		case 38400: return B38400;
+		case 57600: return B57600;
+		case 115200: return B115200;
+		case 230400: return B230400;
+#ifdef B250000
+		case 250000: return B250000;
+#endif
+		default:
+			fprintf(stderr, "Unsupported baud rate %ld\n", baud);
+			exit(1);
+	}
+}
+
+static int open_serial(const char* device, long baud) {
+	struct termios tio;
+	int fd = open(device, O_RDONLY | O_NOCTTY);
+	if(fd < 0) {
+		perror(device);
+		exit(1);
+	}
+	tcgetattr(fd, &tio);
+	cfmakeraw(&tio);
+	cfsetispeed(&tio, baud_constant(baud));
+	cfsetospeed(&tio, baud_constant(baud));
+	tio.c_cc[VMIN] = 1;
+	tio.c_cc[VTIME] = 0;
+	tcsetattr(fd, TCSANOW, &tio);
+	return fd;
+}
+
+static int block_height(int block, int rotation) {
+	return (rotation % 2 == 0) ? block_library[block].height :
+			block_library[block].width;
+}
+
+static int block_width(int block, int rotation) {
+	return (rotation % 2 == 0) ? block_library[block].width :
+			block_library[block].height;
+}
+
+static int background(uint8_t colour) {
+	switch(colour) {
+		case COLOUR_RED: return 41;
+		case COLOUR_GREEN: return 42;
+		case COLOUR_YELLOW: return 43;
+		case COLOUR_ORANGE: return 44;
+		case COLOUR_LIGHT_ORANGE: return 45;
+		case COLOUR_LIGHT_YELLOW: return 45;
+		case COLOUR_LIGHT_GREEN: return 47;
+		default: return 40;
+	}
+}
+
+static void draw(const SpectateState* s) {
+	printf("\x1b[H\x1b[0mScore: %10u  Rows: %5lu  Blocks: %5u\x1b[K\n",
+			s->score, s->rows_cleared, s->lock_count);
+	printf("##########\n");
+	for(int row = 0; row < TELEMETRY_BOARD_ROWS; row++) {
+		printf("#");
+		for(int col = TELEMETRY_BOARD_WIDTH - 1; col >= 0; col--) {
+			int falling = 0;
+			if(s->falling_block >= 0 &&
+					row < block_height(s->falling_block, s->falling_rotation)) {
+				rowtype bits = block_library[s->falling_block].
+						patterns[s->falling_rotation][row] << s->falling_column;
+				falling = (bits >> col) & 1;
+			}
+			if(falling) {
+				printf("\x1b[%dm \x1b[0m",
+						background(block_library[s->falling_block].colour));
+			} else if(s->board[row] & (1 << col)) {
+				// Blocks we only know about from a keyframe are shown grey
+				if(s->colours[row][col] == UNKNOWN_COLOUR) {
+					printf("\x1b[7m \x1b[0m");
+				} else {
+					printf("\x1b[%dm \x1b[0m", background(s->colours[row][col]));
+				}
+			} else {
+				printf(" ");
+			}
+		}
+		printf("#");
+		if(row == 1) {
+			printf("   Next:");
+		} else if(row >= 2 && row < 6 && s->next_block >= 0) {
+			int r = row - 2;
+			printf("   ");
+			for(int col = block_width(s->next_block, s->next_rotation) - 1;
+					col >= 0 && r < block_height(s->next_block, s->next_rotation);
+					col--) {
+				int set = block_library[s->next_block].patterns[s->next_rotation][r] &
+						(1 << col);
+				printf("%s \x1b[0m", set ? "\x1b[7m" : "");
+			}
+		}
+		printf("\x1b[K\n");
+	}
+	printf("##########\n");
+	printf("bytes %lu  records %lu  keyframes %lu (%lu matched)  new games %lu\x1b[K\n"
+			"crc errors %lu  lost %lu  desyncs %lu\x1b[K\n", s->bytes, s->records,
+			s->keyframes, s->keyframes_ok, s->new_games, s->crc_errors, s->lost,
+			s->desyncs);
+	fflush(stdout);
+}
+
+// Remove completed rows, shifting the rows above down - as the game does
+static void clear_completed_rows(SpectateState* s) {
+	for(int row = 0; row < TELEMETRY_BOARD_ROWS; row++) {
+		if(s->board[row] != (1 << TELEMETRY_BOARD_WIDTH) - 1) {
+			continue;
+		}
+		for(int r = row; r > 0; r--) {
+			s->board[r] = s->board[r - 1];
+			memcpy(s->colours[r], s->colours[r - 1], TELEMETRY_BOARD_WIDTH);
+		}
+		s->board[0] = 0;
+		memset(s->colours[0], COLOUR_BLACK, TELEMETRY_BOARD_WIDTH);
+		s->rows_cleared++;
+	}
+}
+
+static void apply_lock(SpectateState* s, uint8_t first, uint8_t second) {
+	int block = (first >> 2) & 0x07;
+	int rotation = first & 0x03;
+	int row = second >> 4;
+	int column = second & 0x0F;
+
+	if(block >= NUM_BLOCKS_IN_LIBRARY) {
+		s->desyncs++;
+		return;
+	}
+	for(int r = 0; r < block_height(block, rotation) &&
+			row + r < TELEMETRY_BOARD_ROWS; r++) {
+		rowtype bits = block_library[block].patterns[rotation][r] << column;
+		if(s->board[row + r] & bits) {
+			// Overlaps a block we already have - we're out of step
+			s->desyncs++;
+		}
+		s->board[row + r] |= bits;
+		for(int col = 0; col < TELEMETRY_BOARD_WIDTH; col++) {
+			if(bits & (1 << col)) {
+				s->colours[row + r][col] = block_library[block].colour;
+			}
+		}
+	}
+	s->lock_count++;
+	s->falling_block = -1;
+	clear_completed_rows(s);
+}
+
+static void apply_spawn(SpectateState* s, uint8_t first, uint8_t second) {
+	int block = (first >> 2) & 0x07;
+	int next = second >> 5;
+
+	if(block >= NUM_BLOCKS_IN_LIBRARY || next >= NUM_BLOCKS_IN_LIBRARY) {
+		s->desyncs++;
+		return;
+	}
+	s->falling_block = block;
+	s->falling_rotation = first & 0x03;
+	s->falling_column = second & 0x07;
+	s->next_block = next;
+	s->next_rotation = (second >> 3) & 0x03;
+}
+
+static void apply_keyframe(SpectateState* s, const uint8_t* payload, uint8_t length) {
+	unsigned lock_count;
+	int empty, row;
+
+	if(length < 2 + TELEMETRY_BOARD_ROWS + 4) {
+		return;
+	}
+	s->keyframes++;
+	lock_count = payload[0] | (payload[1] << 8);
+	s->score = payload[18] | (payload[19] << 8) |
+			((uint32_t)payload[20] << 16) | ((uint32_t)payload[21] << 24);
+	if(lock_count == (s->lock_count & 0xFFFF) &&
+			memcmp(s->board, payload + 2, TELEMETRY_BOARD_ROWS) == 0) {
+		s->keyframes_ok++;
+		return;
+	}
+	// Out of step (or a new game was started) - take the keyframe's board.
+	// We keep the colours of cells which were already occupied.
+	for(empty = 1, row = 0; row < TELEMETRY_BOARD_ROWS; row++) {
+		empty &= payload[2 + row] == 0;
+	}
+	if(empty) {
+		s->new_games++;
+		s->rows_cleared = 0;
+	} else if(s->keyframes > 1) {
+		s->desyncs++;
+	}
+	for(row = 0; row < TELEMETRY_BOARD_ROWS; row++) {
+		for(int col = 0; col < TELEMETRY_BOARD_WIDTH; col++) {
+			int was = (s->board[row] >> col) & 1;
+			int now = (payload[2 + row] >> col) & 1;
+			if(now && !was) {
+				s->colours[row][col] = UNKNOWN_COLOUR;
+			}
+		}
+		s->board[row] = payload[2 + row];
+	}
+	s->lock_count = lock_count;
+}
+
+int main(int argc, char* argv[]) {
+	static SpectateState state;
+	uint8_t frame[TELEMETRY_HEADER_SIZE + 256 + 1];
+	uint8_t record = 0;	// first byte of a record, 0 if not in a record
+	int fd = 0;
+	int have = 0;		// bytes of the current frame received so far
+	uint8_t byte;
+
+	if(argc > 1) {
+		fd = open_serial(argv[1], (argc > 2) ? atol(argv[2]) : 19200);
+	}
+	state.falling_block = -1;
+	state.next_block = -1;
+	state.last_sequence = -1;
+	printf("\x1b[2J\x1b[?25l");
+	draw(&state);
+
+	while(read(fd, &byte, 1) == 1) {
+		state.bytes++;
+		if(record) {
+			if((record & TELEMETRY_RECORD_TYPE_MASK) == TELEMETRY_RECORD_LOCK) {
+				apply_lock(&state, record, byte);
+			} else {
+				apply_spawn(&state, record, byte);
+			}
+			state.records++;
+			record = 0;
+			draw(&state);
+			continue;
+		}
+		if(have == 0) {
+			if((byte & TELEMETRY_RECORD_TYPE_MASK) == TELEMETRY_RECORD_LOCK ||
+					(byte & TELEMETRY_RECORD_TYPE_MASK) == TELEMETRY_RECORD_SPAWN) {
+				record = byte;
+				continue;
+			}
+			if(byte != TELEMETRY_SYNC) {
+				continue;	// not part of a record or message
+			}
+		}
+		frame[have++] = byte;
+		if(have < TELEMETRY_HEADER_SIZE ||
+				have < TELEMETRY_HEADER_SIZE + frame[3] + 1) {
+			continue;
+		}
+		// Complete message - check the CRC
+		uint8_t crc = 0;
+		for(int i = 1; i < have - 1; i++) {
+			crc = telemetry_crc8(crc, frame[i]);
+		}
+		if(crc != frame[have - 1]) {
+			state.crc_errors++;
+			// Look for a sync byte within what we've received
+			int resync = 1;
+			while(resync < have && frame[resync] != TELEMETRY_SYNC) {
+				resync++;
+			}
+			memmove(frame, frame + resync, have - resync);
+			have -= resync;
+			continue;
+		}
+		if(state.last_sequence >= 0) {
+			state.lost += (uint8_t)(frame[2] - state.last_sequence - 1);
+		}
+		state.last_sequence = frame[2];
+		if(frame[1] == TELEMETRY_MSG_KEYFRAME) {
+			apply_keyframe(&state, frame + TELEMETRY_HEADER_SIZE, frame[3]);
+		}
+		have = 0;
+		draw(&state);
+	}
+	printf("\x1b[?25h\n");
+	return 0;
+}
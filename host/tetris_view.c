@@ -0,0 +1,203 @@
+/*
+ * tetris_view.c
+ *
+ * Host (Linux) viewer for the binary telemetry stream (see telemetry.h).
+ * Reads the stream from a serial device (or standard input), rebuilds the
+ * board, score and next block and draws them on the local terminal.
+ * Anything which isn't a valid message (e.g. ordinary terminal output from
+ * the game) is ignored.
+ *
+ * Build and run:
+ *     cc -o tetris_view host/tetris_view.c
+ *     ./tetris_view /dev/ttyUSB0 19200
+ * Press 't' in the game's serial console to switch the stream on.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+
+#include "../telemetry.h"
+
+typedef struct {
+	uint8_t colours[TELEMETRY_BOARD_CELLS];
+	uint32_t score;
+	uint8_t rows;
+	int next_block, next_rotation;
+	// Statistics
+	unsigned long bytes, messages, crc_errors, lost, desyncs;
+	int last_sequence;
+} ViewState;
+
+// Background colour used for each colour index (matches the game's own
+// terminal output)
+static const int background[] = { 40, 41, 42, 43, 44, 45, 45, 47, 46, 40 };
+
+static speed_t baud_constant(long baud) {
+	switch(baud) {
+		case 9600: return B9600;
+		case 19200: return B19200;
+		case 38400: return B38400;
+		case 57600: return B57600;
+		case 115200: return B115200;
+		case 230400: return B230400;
+#ifdef B250000
+		case 250000: return B250000;
+#endif
+		default:
+			fprintf(stderr, "Unsupported baud rate %ld\n", baud);
+			exit(1);
+	}
+}
+
+static int open_serial(const char* device, long baud) {
+	struct termios tio;
+	int fd = open(device, O_RDONLY | O_NOCTTY);
+	if(fd < 0) {
+		perror(device);
+		exit(1);
+	}
+	tcgetattr(fd, &tio);
+	cfmakeraw(&tio);
+	cfsetispeed(&tio, baud_constant(baud));
+	cfsetospeed(&tio, baud_constant(baud));
+	tio.c_cc[VMIN] = 1;
+	tio.c_cc[VTIME] = 0;
+	tcsetattr(fd, TCSANOW, &tio);
+	return fd;
+}
+
+static void draw(const ViewState* view) {
+	printf("\x1b[H\x1b[0mScore: %10u  Rows: %3u\n", view->score, view->rows);
+	printf("##########\n");
+	for(int row = 0; row < TELEMETRY_BOARD_ROWS; row++) {
+		printf("#");
+		for(int col = 0; col < TELEMETRY_BOARD_WIDTH; col++) {
+			uint8_t colour = view->colours[row * TELEMETRY_BOARD_WIDTH + col];
+			printf("\x1b[%dm \x1b[0m", background[colour]);
+		}
+		printf("#");
+		if(row == 1) {
+			printf("   Next:");
+		} else if(row >= 2 && row < 6 && view->next_block >= 0) {
+			// Draw the next block (rows 2 to 5 of the display)
+			const BlockInfo* info = &block_library[view->next_block];
+			int r = row - 2;
+			int height = (view->next_rotation % 2 == 0) ? info->height : info->width;
+			int width = (view->next_rotation % 2 == 0) ? info->width : info->height;
+			printf("   ");
+			for(int col = width - 1; col >= 0 && r < height; col--) {
+				int set = info->patterns[view->next_rotation][r] & (1 << col);
+				printf("%s \x1b[0m", set ? "\x1b[7m" : "");
+			}
+		}
+		printf("\x1b[K\n");
+	}
+	printf("##########\n");
+	printf("bytes %lu  messages %lu  crc errors %lu  lost %lu  desyncs %lu\x1b[K\n",
+			view->bytes, view->messages, view->crc_errors, view->lost, view->desyncs);
+	fflush(stdout);
+}
+
+static void apply_message(ViewState* view, uint8_t type, const uint8_t* payload,
+		uint8_t length) {
+	switch(type) {
+		case TELEMETRY_MSG_COLOURS: {
+			int cell = payload[0];
+			for(int i = 1; i + 1 < length; i += 2) {
+				cell += payload[i];
+				for(int run = 0; run <= (payload[i+1] >> 4); run++) {
+					if(cell < TELEMETRY_BOARD_CELLS) {
+						view->colours[cell++] = payload[i+1] & 0x0F;
+					}
+				}
+			}
+			break;
+		}
+		case TELEMETRY_MSG_BITBOARD:
+			// Check our colours agree with the occupancy sent
+			for(int row = 0; row < TELEMETRY_BOARD_ROWS && row < length; row++) {
+				for(int col = 0; col < TELEMETRY_BOARD_WIDTH; col++) {
+					uint8_t colour = view->colours[row * TELEMETRY_BOARD_WIDTH + col];
+					int occupied = colour != TELEMETRY_COLOUR_BLACK &&
+							colour != TELEMETRY_COLOUR_GHOST;
+					int expected = (payload[row] >> (TELEMETRY_BOARD_WIDTH - 1 - col)) & 1;
+					if(occupied != expected) {
+						view->desyncs++;
+						return;
+					}
+				}
+			}
+			break;
+		case TELEMETRY_MSG_SCORE:
+			if(length >= 5) {
+				view->score = payload[0] | (payload[1] << 8) | 
+						((uint32_t)payload[2] << 16) | ((uint32_t)payload[3] << 24);
+				view->rows = payload[4];
+			}
+			break;
+		case TELEMETRY_MSG_NEXT:
+			if(length >= 2 && payload[0] < NUM_BLOCKS_IN_LIBRARY) {
+				view->next_block = payload[0];
+				view->next_rotation = payload[1] % NUM_ROTATIONS;
+			}
+			break;
+	}
+}
+
+int main(int argc, char* argv[]) {
+	static ViewState view;
+	uint8_t frame[TELEMETRY_HEADER_SIZE + 256 + 1];
+	int fd = 0;
+	int have = 0;		// bytes of the current frame received so far
+	uint8_t byte;
+
+	if(argc > 1) {
+		fd = open_serial(argv[1], (argc > 2) ? atol(argv[2]) : 19200);
+	}
+	view.next_block = -1;
+	view.last_sequence = -1;
+	printf("\x1b[2J\x1b[?25l");
+	draw(&view);
+
+	while(read(fd, &byte, 1) == 1) {
+		view.bytes++;
+		if(have == 0 && byte != TELEMETRY_SYNC) {
+			continue;	// not part of a message
+		}
+		frame[have++] = byte;
+		if(have < TELEMETRY_HEADER_SIZE || 
+				have < TELEMETRY_HEADER_SIZE + frame[3] + 1) {
+			continue;
+		}
+		// Complete message - check the CRC
+		uint8_t crc = 0;
+		for(int i = 1; i < have - 1; i++) {
+			crc = telemetry_crc8(crc, frame[i]);
+		}
+		if(crc != frame[have - 1]) {
+			view.crc_errors++;
+			// Look for a sync byte within what we've received
+			int resync = 1;
+			while(resync < have && frame[resync] != TELEMETRY_SYNC) {
+				resync++;
+			}
+			memmove(frame, frame + resync, have - resync);
+			have -= resync;
+			continue;
+		}
+		view.messages++;
+		if(view.last_sequence >= 0) {
+			view.lost += (uint8_t)(frame[2] - view.last_sequence - 1);
+		}
+		view.last_sequence = frame[2];
+		apply_message(&view, frame[1], frame + TELEMETRY_HEADER_SIZE, frame[3]);
+		have = 0;
+		draw(&view);
+	}
+	printf("\x1b[?25h\n");
+	return 0;
+}
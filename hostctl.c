@@ -0,0 +1,156 @@
+/*
+ * hostctl.c
+ *
+ * Host control protocol - see hostctl.h for the frame format and
+ * commands. Frames are put together here as their bytes are received
+ * (see serial_input_poll()) and complete commands are queued. The game
+ * loop takes them from the queue, carries them out and acknowledges them.
+ */
+
+#include <string.h>
+
+#include "hostctl.h"
+#include "serialio.h"
+#include "game.h"
+
+// Frame being received, and the number of bytes of it received so far
+// (0 if we're not part way through a frame)
+static uint8_t frame[HOSTCTL_HEADER_SIZE + HOSTCTL_MAX_PAYLOAD + 1];
+static uint8_t received;
+static uint16_t errors;
+
+// Commands waiting to be carried out - a circular buffer. (Only used from
+// the main program.)
+#define COMMAND_QUEUE_SIZE 4
+#define COMMAND_QUEUE_MASK (COMMAND_QUEUE_SIZE - 1)
+static HostCommand command_queue[COMMAND_QUEUE_SIZE];
+static uint8_t queue_head;
+static uint8_t queue_tail;
+
+// Sequence number of the last command accepted (-1 if none yet) and the
+// status it was acknowledged with
+static int16_t last_sequence = -1;
+static uint8_t last_status;
+
+static uint8_t reply[HOSTCTL_HEADER_SIZE + HOSTCTL_REPLY_HEADER +
+		HOSTCTL_STATE_SIZE + 1];
+
+static void send_reply(uint8_t type, uint8_t sequence, uint8_t status) {
+	uint8_t* payload = reply + HOSTCTL_HEADER_SIZE;
+	uint8_t* state = payload + HOSTCTL_REPLY_HEADER;
+	uint8_t length = HOSTCTL_REPLY_HEADER;
+	uint16_t hash = 0xFFFF;
+	uint8_t crc = 0;
+
+	get_game_state(state);
+	for(uint8_t i = 0; i < HOSTCTL_STATE_SIZE; i++) {
+		hash = hostctl_crc16(hash, state[i]);
+	}
+	if(type == HOSTCTL_CMD_QUERY || type == HOSTCTL_CMD_PLACE) {
+		length += HOSTCTL_STATE_SIZE;
+	}
+	reply[0] = HOSTCTL_SYNC;
+	reply[1] = type | HOSTCTL_REPLY;
+	reply[2] = sequence;
+	reply[3] = length;
+	payload[0] = status;
+	payload[1] = hash;
+	payload[2] = hash >> 8;
+	length += HOSTCTL_HEADER_SIZE;
+	for(uint8_t i = 1; i < length; i++) {
+		crc = telemetry_crc8(crc, reply[i]);
+	}
+	reply[length] = crc;
+	// Sent whole or not at all - if it's lost the host sends the command
+	// again and gets another reply
+	serial_write((const char*)reply, length + 1);
+}
+
+static void accept_frame(void) {
+	uint8_t sequence = frame[2];
+	HostCommand* command;
+
+	if(sequence == last_sequence) {
+		// Repeat of the last command. If it has been carried out the host
+		// can't have seen the reply - send it again. (Otherwise it will be
+		// acknowledged when it has been carried out.)
+		if(queue_head == queue_tail) {
+			send_reply(frame[1], sequence, last_status);
+		}
+		return;
+	}
+	if((uint8_t)(queue_head - queue_tail) >= COMMAND_QUEUE_SIZE) {
+		send_reply(frame[1], sequence, HOSTCTL_BUSY);
+		return;
+	}
+	command = &command_queue[queue_head & COMMAND_QUEUE_MASK];
+	command->type = frame[1];
+	command->sequence = sequence;
+	command->length = frame[3];
+	memcpy(command->payload, frame + HOSTCTL_HEADER_SIZE, frame[3]);
+	queue_head++;
+	last_sequence = sequence;
+}
+
+// Throw away the start of the frame buffer, up to the next sync byte at
+// or after position skip
+static void skip_to_sync(uint8_t skip) {
+	while(skip < received && frame[skip] != HOSTCTL_SYNC) {
+		skip++;
+	}
+	received -= skip;
+	memmove(frame, frame + skip, received);
+}
+
+uint8_t hostctl_receive(uint8_t c) {
+	if(received == 0 && c != HOSTCTL_SYNC) {
+		return 0;
+	}
+	frame[received++] = c;
+	// Normally this goes round once. After a bad frame (most likely bytes
+	// were lost and it has run into the next one) we look again from the
+	// next sync byte we have, which may already be a whole frame.
+	while(received >= HOSTCTL_HEADER_SIZE) {
+		uint8_t length = HOSTCTL_HEADER_SIZE + frame[3];
+		uint8_t crc = 0;
+
+		if(frame[3] > HOSTCTL_MAX_PAYLOAD) {
+			errors++;
+			skip_to_sync(1);
+			continue;
+		}
+		if(received <= length) {
+			break;		// wait for the rest
+		}
+		for(uint8_t i = 1; i < length; i++) {
+			crc = telemetry_crc8(crc, frame[i]);
+		}
+		if(crc != frame[length]) {
+			errors++;
+			skip_to_sync(1);
+			continue;
+		}
+		accept_frame();
+		skip_to_sync(length + 1);
+	}
+	return 1;
+}
+
+uint8_t hostctl_next_command(HostCommand* command) {
+	if(queue_head == queue_tail) {
+		return 0;
+	}
+	*command = command_queue[queue_tail++ & COMMAND_QUEUE_MASK];
+	return 1;
+}
+
+void hostctl_acknowledge(HostCommand* command, uint8_t status) {
+	if(command->sequence == last_sequence) {
+		last_status = status;
+	}
+	send_reply(command->type, command->sequence, status);
+}
+
+uint16_t hostctl_errors(void) {
+	return errors;
+}
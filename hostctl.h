@@ -0,0 +1,125 @@
+/*
+ * hostctl.h
+ *
+ * Host control protocol - lets a program on the host (e.g. a bot) drive
+ * the game with acknowledged commands rather than pretending to be a
+ * person at the terminal. This file is shared with the host programs so
+ * must only depend on the standard integer types (and telemetry.h).
+ *
+ * Commands and replies are framed as telemetry messages are (see
+ * telemetry.h), but with their own sync byte:
+ *	HOSTCTL_SYNC  type  sequence  length  payload[length]  crc
+ * Every command gets exactly one reply, with the same sequence number and
+ * type | HOSTCTL_REPLY. The reply payload is a status, then the hash of
+ * the game state after the command (2 bytes, least significant first -
+ * see below), then anything specific to the command. If a command is
+ * received with the same sequence number as the one before it, it is
+ * assumed to be a repeat (the host didn't see our reply) and is
+ * acknowledged again without being carried out. Commands with a bad CRC
+ * are ignored - the host should send them again if no reply arrives.
+ * Frames can contain any byte values (including XON and XOFF) so the host
+ * must not use software flow control - if it waits for each reply before
+ * sending the next command it can't overrun the game. (Nor does the game -
+ * its XON/XOFF flow control, if built in, is turned off once it has
+ * received a command.)
+ *
+ * Commands:
+ * STEP - advance the game by the given number of milliseconds of game
+ *		time (2 bytes, least significant first), dropping the falling block
+ *		whenever the drop interval has elapsed.
+ * ACTION - carry out one action (1 byte - ACTION_LEFT, ACTION_RIGHT,
+ *		ACTION_ROTATE or ACTION_DROP from input.h). Status is
+ *		HOSTCTL_FAILED if the block couldn't be moved.
+ * QUERY - no payload. The reply has the game state after the hash.
+ * SEED - start a new game with the random number generator seeded with
+ *		the given value (4 bytes, least significant first), then a flags
+ *		byte. With HOSTCTL_LOCKSTEP set the game only advances when told
+ *		to (with STEP) and stays over at the end of a game until the next
+ *		SEED. Otherwise the game runs in real time as usual, and a SEED
+ *		sent while the game over screen is showing starts the next game.
+ * REPEAT - set the auto repeat times for held buttons and joystick
+ *		directions (see input.h): delayed auto shift then auto repeat rate,
+ *		in milliseconds (2 bytes each, least significant first).
+ * PLACE - move the falling block straight to the given rotation and
+ *		column (1 byte each), then a flags byte. With HOSTCTL_PLACE_DROP set
+ *		the block is then hard dropped. Status is HOSTCTL_FAILED (and
+ *		nothing is done) if the block couldn't get there by moving and
+ *		rotating. The reply has the game state after the hash, so a bot
+ *		needs only one command per block.
+ *
+ * Game state (HOSTCTL_STATE_SIZE bytes):
+ *	0-15	board rows (row 0 first) without the falling block - bit n is
+ *			column n (column 0 on the right)
+ *	16-19	falling block number, rotation, row and column
+ *	20-21	next block number and rotation
+ *	22-25	score (least significant first)
+ *	26		rows cleared
+ * The state hash is hostctl_crc16() over these bytes, starting from
+ * 0xFFFF.
+ */
+
+#ifndef HOSTCTL_H_
+#define HOSTCTL_H_
+
+#include <stdint.h>
+#include "telemetry.h"
+
+#define HOSTCTL_SYNC 0xF6
+#define HOSTCTL_HEADER_SIZE 4		// sync, type, sequence, length
+#define HOSTCTL_MAX_PAYLOAD 8		// longest command payload
+
+#define HOSTCTL_CMD_STEP 0x01
+#define HOSTCTL_CMD_ACTION 0x02
+#define HOSTCTL_CMD_QUERY 0x03
+#define HOSTCTL_CMD_SEED 0x04
+#define HOSTCTL_CMD_PLACE 0x05
+#define HOSTCTL_CMD_REPEAT 0x06
+#define HOSTCTL_REPLY 0x80
+
+#define HOSTCTL_LOCKSTEP 0x01		// SEED flag
+#define HOSTCTL_PLACE_DROP 0x01		// PLACE flag
+
+// Reply status
+#define HOSTCTL_OK 0
+#define HOSTCTL_FAILED 1		// command understood but couldn't be done
+#define HOSTCTL_GAME_OVER 2		// game is over (SEED starts a new one)
+#define HOSTCTL_BAD_COMMAND 3	// unknown type or wrong payload length
+#define HOSTCTL_BUSY 4			// too many commands waiting - send again
+
+#define HOSTCTL_STATE_SIZE 27
+#define HOSTCTL_REPLY_HEADER 3	// status and hash
+
+// CRC-16 (CCITT polynomial 0x1021) used for the state hash
+static inline uint16_t hostctl_crc16(uint16_t crc, uint8_t data) {
+	crc ^= (uint16_t)data << 8;
+	for(uint8_t bit = 0; bit < 8; bit++) {
+		crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+	}
+	return crc;
+}
+
+typedef struct {
+	uint8_t type;
+	uint8_t sequence;
+	uint8_t length;
+	uint8_t payload[HOSTCTL_MAX_PAYLOAD];
+} HostCommand;
+
+/*
+ * Offer a received byte to the protocol. Returns 1 if it was part of a
+ * command frame (so shouldn't be treated as terminal input), 0 if not.
+ */
+uint8_t hostctl_receive(uint8_t c);
+
+/*
+ * Take the next command waiting to be carried out. Returns 0 if there
+ * isn't one. Every command taken must be acknowledged (once it has been
+ * carried out) with hostctl_acknowledge().
+ */
+uint8_t hostctl_next_command(HostCommand* command);
+void hostctl_acknowledge(HostCommand* command, uint8_t status);
+
+// Number of frames received with a bad CRC or length
+uint16_t hostctl_errors(void);
+
+#endif /* HOSTCTL_H_ */
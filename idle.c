@@ -0,0 +1,55 @@
+/*
+ * idle.c
+ *
+ * Idle sleep and CPU load measurement - see idle.h.
+ */
+
+#include <stdint.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+
+#include "idle.h"
+#include "timer0.h"
+
+// get_fine_clock() counts per millisecond
+#define COUNTS_PER_MS 125
+
+// Time asleep (in get_fine_clock() counts) since measure_start (in clock
+// ticks)
+static uint32_t idle_counts;
+static uint32_t measure_start;
+
+void idle_sleep(void) {
+	uint16_t start;
+
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	cli();
+	start = get_fine_clock();
+	sleep_enable();
+	// The instruction after sei is always carried out before any interrupt
+	// is handled, so an interrupt which is already waiting wakes us up
+	// straight away rather than being handled before we go to sleep
+	sei();
+	sleep_cpu();
+	sleep_disable();
+	idle_counts += (uint16_t)(get_fine_clock() - start);
+}
+
+uint8_t idle_percent(void) {
+	uint32_t now = get_clock_ticks();
+	uint32_t elapsed = now - measure_start;
+	uint32_t percent = 0;
+
+	if(elapsed) {
+		// idle_counts / (elapsed * COUNTS_PER_MS / 100)
+		percent = idle_counts / ((elapsed * (COUNTS_PER_MS / 25)) / 4);
+		if(percent > 100) {
+			percent = 100;
+		}
+	}
+	idle_counts = 0;
+	measure_start = now;
+	return percent;
+}
@@ -0,0 +1,33 @@
+/*
+ * idle.h
+ *
+ * Sleeping while there's nothing to do. Everything the program waits for
+ * (the millisecond timer, serial input and output, buttons and the
+ * joystick) is interrupt driven, so instead of spinning round a loop
+ * checking for it we put the CPU into idle sleep mode until the next
+ * interrupt. Timer 0 wakes us up every millisecond, so anything which is
+ * checked by time still happens on time.
+ *
+ * The time spent asleep is measured (to 8us, with get_fine_clock() - see
+ * timer0.h) so we can tell how busy the CPU is.
+ */
+
+#ifndef IDLE_H_
+#define IDLE_H_
+
+#include <stdint.h>
+
+/*
+ * Sleep until the next interrupt (and that interrupt has been handled).
+ * Interrupts must be on.
+ */
+void idle_sleep(void);
+
+/*
+ * Return the percentage of the time the CPU has been asleep since this
+ * was last called, and start measuring again. (Time while the game is
+ * paused doesn't count - the clock is stopped.)
+ */
+uint8_t idle_percent(void);
+
+#endif /* IDLE_H_ */
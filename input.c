@@ -0,0 +1,136 @@
+/*
+ * input.c
+ *
+ * Input event queue and auto repeat - see input.h.
+ *
+ * Events are added by the button and ADC interrupt handlers and (for
+ * cursor keys) by serial_input_poll() in the main program, and only the
+ * main program takes them out. Interrupt handlers don't interrupt each
+ * other and the main program adds events with interrupts off, so there is
+ * only ever one writer at a time. The queue then works like the serial
+ * buffers (see serialio.c) - the writer fills in an event before moving
+ * queue_head on and only the reader changes queue_tail, so taking events
+ * out never needs interrupts turned off.
+ */
+
+#include <stdint.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "input.h"
+#include "timer0.h"
+
+// NOTE - EVENT_QUEUE_SIZE must be a power of two no larger than 256
+#define EVENT_QUEUE_SIZE 16
+#define EVENT_QUEUE_MASK (EVENT_QUEUE_SIZE - 1)
+static volatile InputEvent event_queue[EVENT_QUEUE_SIZE];
+static volatile uint8_t queue_head;
+static volatile uint8_t queue_tail;
+static volatile uint16_t overruns;
+
+// Auto repeat. held_action is the action being held down (-1 if none),
+// held_source where it came from and repeat_time when it next repeats.
+static int8_t held_action = -1;
+static uint8_t held_source;
+static uint16_t repeat_time;
+static uint16_t das = INPUT_DAS;
+static uint16_t arr = INPUT_ARR;
+
+void input_event(uint8_t action, uint8_t source) {
+	uint8_t interrupts_were_on = bit_is_set(SREG, SREG_I);
+	cli();
+	uint8_t head = queue_head;
+	if((uint8_t)(head - queue_tail) >= EVENT_QUEUE_SIZE) {
+		overruns++;
+	} else {
+		volatile InputEvent* event = &event_queue[head & EVENT_QUEUE_MASK];
+		event->action = action;
+		event->source = source;
+		event->time = get_clock_ticks16();
+#if LATENCY_STATS
+		event->stamp = get_fine_clock();
+#endif
+		queue_head = head + 1;
+	}
+	if(interrupts_were_on) {
+		sei();
+	}
+}
+
+uint8_t input_next_event(InputEvent* event) {
+	uint8_t tail = queue_tail;
+
+	if(tail == queue_head) {
+		return 0;
+	}
+	event->action = event_queue[tail & EVENT_QUEUE_MASK].action;
+	event->source = event_queue[tail & EVENT_QUEUE_MASK].source;
+	event->time = event_queue[tail & EVENT_QUEUE_MASK].time;
+#if LATENCY_STATS
+	event->stamp = event_queue[tail & EVENT_QUEUE_MASK].stamp;
+#endif
+	queue_tail = tail + 1;
+	return 1;
+}
+
+int8_t input_next_action(void) {
+	InputEvent event;
+	uint16_t now;
+
+	while(input_next_event(&event)) {
+		if(event.source & INPUT_RELEASED) {
+			if(event.action == held_action &&
+					(event.source & ~INPUT_RELEASED) == held_source) {
+				held_action = -1;
+			}
+			continue;
+		}
+		if(event.source != INPUT_SERIAL && event.action != ACTION_DROP) {
+			// Repeats are timed from when it was pressed, not from when
+			// we got round to it
+			held_action = event.action;
+			held_source = event.source;
+			repeat_time = event.time + das;
+		}
+#if LATENCY_STATS
+		latency_input_taken(event.source, event.stamp);
+#endif
+		return event.action;
+	}
+
+	now = get_clock_ticks16();
+	if(held_action != -1 && clock16_reached(now, repeat_time)) {
+		// Next repeat is due one interval after this one was due, unless
+		// we've fallen more than an interval behind (we don't want a burst
+		// of repeats to catch up)
+		repeat_time += arr;
+		if(clock16_reached(now, repeat_time)) {
+			repeat_time = now + arr;
+		}
+		latency_input_taken(LATENCY_REPEAT, 0);
+		return held_action;
+	}
+	return -1;
+}
+
+void input_reset(void) {
+	queue_tail = queue_head;
+	held_action = -1;
+}
+
+void input_set_repeat(uint16_t new_das, uint16_t new_arr) {
+	das = new_das;
+	arr = new_arr;
+}
+
+uint16_t input_overruns(void) {
+	uint16_t count;
+
+	// Written by interrupt handlers - read it until we get the same value
+	// twice so we don't see it half updated
+	do {
+		count = overruns;
+	} while(count != overruns);
+	return count;
+}
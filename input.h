@@ -0,0 +1,86 @@
+/*
+ * input.h
+ *
+ * Input events. The push buttons, the joystick and the cursor keys at the
+ * serial terminal all report what happens to them as events - an action
+ * (ACTION_LEFT etc.), where it came from, whether it was a press or a
+ * release, and when it happened. The events go into one queue in the
+ * order they happened, and the game takes actions from it with
+ * input_next_action(). That also does auto repeat: an action held down
+ * (on a button or the joystick) repeats once it has been held for the
+ * delayed auto shift time (DAS), then every auto repeat rate time (ARR)
+ * until it is released. Drops don't repeat. Cursor keys are never
+ * released - the terminal does its own auto repeat.
+ *
+ * The action values are also used by the host control protocol (see
+ * hostctl.h), so this file must only depend on the standard integer types
+ * and latency.h (for the latency timestamp in InputEvent), which only
+ * depends on them too.
+ */
+
+#ifndef INPUT_H_
+#define INPUT_H_
+
+#include <stdint.h>
+#include "latency.h"
+
+// Actions. (Values below ' ' so that they can't clash with the printable
+// characters typed at the terminal.)
+#define ACTION_LEFT 1
+#define ACTION_RIGHT 2
+#define ACTION_ROTATE 3
+#define ACTION_DROP 4
+
+// Event sources. INPUT_RELEASED is added for a release.
+#define INPUT_BUTTON 0
+#define INPUT_JOYSTICK 1
+#define INPUT_SERIAL 2
+#define INPUT_RELEASED 0x80
+
+// Default auto repeat times (ms)
+#ifndef INPUT_DAS
+#define INPUT_DAS 500
+#endif
+#ifndef INPUT_ARR
+#define INPUT_ARR 50
+#endif
+
+typedef struct {
+	uint8_t action;
+	uint8_t source;		// INPUT_BUTTON etc. (+ INPUT_RELEASED)
+	uint16_t time;		// clock ticks (bottom 16 bits) when it happened
+#if LATENCY_STATS
+	uint16_t stamp;		// get_fine_clock() when it happened
+#endif
+} InputEvent;
+
+/*
+ * Add an event to the queue, timestamped with the current time. May be
+ * called from interrupt handlers or the main program. (Events are thrown
+ * away, and counted, if the queue is full.)
+ */
+void input_event(uint8_t action, uint8_t source);
+
+/*
+ * Return the next action to carry out - from the next press in the queue
+ * or the auto repeat of an action being held down - or -1 if there isn't
+ * one yet. Releases are dealt with here too.
+ */
+int8_t input_next_action(void);
+
+/*
+ * Take the next event from the queue as it is (without auto repeat).
+ * Returns 0 if the queue is empty.
+ */
+uint8_t input_next_event(InputEvent* event);
+
+// Empty the event queue and stop any auto repeat
+void input_reset(void);
+
+// Set the auto repeat times (ms)
+void input_set_repeat(uint16_t das, uint16_t arr);
+
+// Number of events lost because the queue was full (since power on)
+uint16_t input_overruns(void);
+
+#endif /* INPUT_H_ */
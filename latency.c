@@ -0,0 +1,178 @@
+/*
+ * latency.c
+ *
+ * Input latency measurement - see latency.h.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+
+#include "latency.h"
+#include "input.h"
+#include "serialio.h"
+#include "terminalio.h"
+#include "timer0.h"
+
+#if LATENCY_STATS
+
+#define NUM_SOURCES (INPUT_SERIAL + 1)
+
+/* Histogram buckets. Bucket 0 is anything under 64us (8 clock units),
+ * then each bucket is twice as wide as the one before - bucket n (n > 0)
+ * is from 64 << (n - 1) up to 64 << n microseconds. The last bucket goes
+ * up to the longest time we can measure (524ms).
+ */
+#define LATENCY_BUCKETS 14
+
+typedef struct {
+	uint16_t count;
+	uint16_t min;
+	uint16_t max;
+	uint32_t total;
+	uint16_t histogram[LATENCY_BUCKETS];
+} LatencyStats;
+
+static LatencyStats stats[NUM_SOURCES][LATENCY_NUM_STAGES];
+
+// Input most recently taken (LATENCY_REPEAT if it isn't being timed any
+// further) and when it happened
+static uint8_t input_source = LATENCY_REPEAT;
+static uint16_t input_stamp;
+
+// Input being followed to the terminal. terminal_state is 0 if there
+// isn't one, 1 if we're waiting for the terminal to be updated and 2 if
+// we're waiting for the output up to terminal_position to be sent.
+static uint8_t terminal_state;
+static uint8_t terminal_source;
+static uint16_t terminal_stamp;
+static uint8_t terminal_position;
+
+static void record(uint8_t source, uint8_t stage, uint16_t stamp) {
+	LatencyStats* s = &stats[source][stage];
+	uint16_t time = get_fine_clock() - stamp;
+	uint16_t units = time >> 3;
+	uint8_t bucket = 0;
+
+	if(s->count == UINT16_MAX) {
+		return;		// full - dump them
+	}
+	while(units) {
+		bucket++;
+		units >>= 1;
+	}
+	if(s->count == 0 || time < s->min) {
+		s->min = time;
+	}
+	if(time > s->max) {
+		s->max = time;
+	}
+	s->count++;
+	s->total += time;
+	s->histogram[bucket]++;
+}
+
+void latency_input_taken(uint8_t source, uint16_t stamp) {
+	input_source = source;
+	input_stamp = stamp;
+	if(source != LATENCY_REPEAT) {
+		record(source, LATENCY_APPLY, stamp);
+	}
+}
+
+void latency_board_changed(void) {
+	if(input_source == LATENCY_REPEAT) {
+		return;
+	}
+	record(input_source, LATENCY_LED, input_stamp);
+	terminal_state = 1;
+	terminal_source = input_source;
+	terminal_stamp = input_stamp;
+	input_source = LATENCY_REPEAT;
+}
+
+void latency_terminal_drawn(void) {
+	if(terminal_state == 1) {
+		terminal_position = serial_output_position();
+		terminal_state = 2;
+	}
+}
+
+void latency_poll(void) {
+	if(terminal_state == 2 && serial_output_sent(terminal_position)) {
+		record(terminal_source, LATENCY_TERMINAL, terminal_stamp);
+		terminal_state = 0;
+	}
+}
+
+// Output a time (in clock units) in microseconds
+static void put_time(uint32_t time) {
+	serial_put_uint32(time * 8, 8);
+}
+
+static const char source_names[NUM_SOURCES][9] PROGMEM = {
+	"button  ", "joystick", "serial  "
+};
+static const char stage_names[LATENCY_NUM_STAGES][9] PROGMEM = {
+	"apply   ", "LED     ", "terminal"
+};
+
+uint8_t latency_dump(uint8_t row) {
+	normal_display_mode();
+	move_cursor(3, row++);
+	serial_write_P(
+			PSTR("Latency (us)        count     min     avg     p99     max"));
+	clear_to_end_of_line();
+	for(uint8_t source = 0; source < NUM_SOURCES; source++) {
+		for(uint8_t stage = 0; stage < LATENCY_NUM_STAGES; stage++) {
+			LatencyStats* s = &stats[source][stage];
+
+			move_cursor(3, row++);
+			serial_write_P(source_names[source]);
+			putchar(' ');
+			serial_write_P(stage_names[stage]);
+			serial_put_uint32(s->count, 8);
+			if(s->count) {
+				// 99th percentile - the top of the bucket it's in (or the
+				// maximum, if that's lower)
+				uint32_t wanted = s->count - s->count / 100;
+				uint32_t so_far = 0;
+				uint8_t bucket = 0;
+				while(so_far + s->histogram[bucket] < wanted) {
+					so_far += s->histogram[bucket++];
+				}
+				uint32_t p99 = (uint32_t)8 << bucket;
+				if(p99 > s->max) {
+					p99 = s->max;
+				}
+				put_time(s->min);
+				put_time(s->total / s->count);
+				put_time(p99);
+				put_time(s->max);
+			}
+			clear_to_end_of_line();
+			s->count = 0;
+			s->total = 0;
+			s->max = 0;
+			for(uint8_t bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+				s->histogram[bucket] = 0;
+			}
+		}
+	}
+	return row;
+}
+
+#else
+
+uint8_t latency_dump(uint8_t row) {
+	normal_display_mode();
+	move_cursor(3, row++);
+	serial_write_P(
+			PSTR("Latency stats not built in (define LATENCY_STATS as 1)"));
+	clear_to_end_of_line();
+	return row;
+}
+
+#endif
@@ -0,0 +1,82 @@
+/*
+ * latency.h
+ *
+ * Input latency measurement. Each button push, joystick movement or cursor
+ * key is timestamped when it happens (in the interrupt handler, or when
+ * the escape sequence is decoded) and we time how long it takes to get to
+ * three stages:
+ *	LATENCY_APPLY - the game takes it from the input queue
+ *	LATENCY_LED - the change it made has been sent to the LED matrix
+ *		(the SPI transfers are done)
+ *	LATENCY_TERMINAL - the terminal update showing the change has been
+ *		handed to the UART
+ * Inputs which don't change the board (e.g. a move into a wall) are only
+ * timed to LATENCY_APPLY, as are auto repeats. Only one input is followed
+ * through to the terminal at a time - a newer one takes over.
+ *
+ * For each input source and stage we keep the count, minimum, average,
+ * maximum and a histogram (from which the 99th percentile is estimated).
+ * This takes about 350 bytes of RAM, so is only built in when
+ * LATENCY_STATS is defined as 1 when compiling. Otherwise these functions
+ * do nothing.
+ *
+ * This file is included by input.h, which is shared with the host
+ * programs, so must only depend on the standard integer types.
+ */
+
+#ifndef LATENCY_H_
+#define LATENCY_H_
+
+#include <stdint.h>
+
+#ifndef LATENCY_STATS
+#define LATENCY_STATS 0
+#endif
+
+#define LATENCY_APPLY 0
+#define LATENCY_LED 1
+#define LATENCY_TERMINAL 2
+#define LATENCY_NUM_STAGES 3
+
+// Source for inputs which aren't timed (auto repeats)
+#define LATENCY_REPEAT 0xFF
+
+#if LATENCY_STATS
+
+/*
+ * The game has taken an input from the queue - from the given source
+ * (INPUT_BUTTON etc.) and timestamped with get_fine_clock() (see timer0.h)
+ * when it happened. For an auto repeat, source is LATENCY_REPEAT.
+ */
+void latency_input_taken(uint8_t source, uint16_t stamp);
+
+// The last input taken changed the board (and the LED matrix is updated)
+void latency_board_changed(void);
+
+// The terminal has been completely updated (and the output is in the
+// serial buffer)
+void latency_terminal_drawn(void);
+
+// Check whether the terminal update has been sent - call often
+void latency_poll(void);
+
+#else
+
+static inline void latency_input_taken(uint8_t source, uint16_t stamp) {
+	(void)source;
+	(void)stamp;
+}
+static inline void latency_board_changed(void) { }
+static inline void latency_terminal_drawn(void) { }
+static inline void latency_poll(void) { }
+
+#endif
+
+/*
+ * Print the statistics (in microseconds) at the terminal, starting at the
+ * given row (10 rows - 1 if they aren't built in), then start them again.
+ * Returns the row after the last one printed.
+ */
+uint8_t latency_dump(uint8_t row);
+
+#endif /* LATENCY_H_ */
@@ -0,0 +1,70 @@
+/*
+ * next_block_preview.h
+ *
+ * GENERATED by host/gen_preview.c from blocks.h - do not edit.
+ *
+ * Escape sequences which draw the next block preview (a 5x5 area
+ * with its top left corner at column 20, row 10) for each block and
+ * rotation. Rows are separated by '\n' - the cursor must be moved to
+ * the start of each row and the terminal put in normal display mode
+ * before the row is sent. Each row leaves normal display mode set.
+ */
+
+#ifndef NEXT_BLOCK_PREVIEW_H_
+#define NEXT_BLOCK_PREVIEW_H_
+
+#include <avr/pgmspace.h>
+#include "blocks.h"
+
+#define PREVIEW_X 20
+#define PREVIEW_Y 10
+#define PREVIEW_SIZE 5
+
+static const char preview_0_0[] PROGMEM =
+	"\x1b[7;31m \x1b[0m    \n     \n     \n     \n     ";
+static const char preview_1_0[] PROGMEM =
+	"\x1b[7;34m \x1b[0m    \n\x1b[7;34m \x1b[0m    \n\x1b[7;34m \x1b[0m    \n     \n     ";
+static const char preview_1_1[] PROGMEM =
+	"\x1b[7;34m   \x1b[0m  \n     \n     \n     \n     ";
+static const char preview_2_0[] PROGMEM =
+	"\x1b[7;32m  \x1b[0m   \n\x1b[7;32m  \x1b[0m   \n     \n     \n     ";
+static const char preview_3_0[] PROGMEM =
+	"\x1b[7;30m \x1b[33m \x1b[30m \x1b[0m  \n\x1b[7;33m   \x1b[0m  \n     \n     \n     ";
+static const char preview_3_1[] PROGMEM =
+	"\x1b[7;33m \x1b[30m \x1b[0m   \n\x1b[7;33m  \x1b[0m   \n\x1b[7;33m \x1b[30m \x1b[0m   \n     \n     ";
+static const char preview_3_2[] PROGMEM =
+	"\x1b[7;33m   \x1b[0m  \n\x1b[7;30m \x1b[33m \x1b[30m \x1b[0m  \n     \n     \n     ";
+static const char preview_3_3[] PROGMEM =
+	"\x1b[7;30m \x1b[33m \x1b[0m   \n\x1b[7;33m  \x1b[0m   \n\x1b[7;30m \x1b[33m \x1b[0m   \n     \n     ";
+static const char preview_4_0[] PROGMEM =
+	"\x1b[7;30m  \x1b[35m \x1b[0m  \n\x1b[7;35m   \x1b[0m  \n     \n     \n     ";
+static const char preview_4_1[] PROGMEM =
+	"\x1b[7;35m \x1b[30m \x1b[0m   \n\x1b[7;35m \x1b[30m \x1b[0m   \n\x1b[7;35m  \x1b[0m   \n     \n     ";
+static const char preview_4_2[] PROGMEM =
+	"\x1b[7;35m   \x1b[0m  \n\x1b[7;35m \x1b[30m  \x1b[0m  \n     \n     \n     ";
+static const char preview_4_3[] PROGMEM =
+	"\x1b[7;35m  \x1b[0m   \n\x1b[7;30m \x1b[35m \x1b[0m   \n\x1b[7;30m \x1b[35m \x1b[0m   \n     \n     ";
+static const char preview_5_0[] PROGMEM =
+	"\x1b[7;37m \x1b[0m    \n\x1b[7;37m \x1b[0m    \n\x1b[7;37m \x1b[0m    \n\x1b[7;37m \x1b[0m    \n     ";
+static const char preview_5_1[] PROGMEM =
+	"\x1b[7;37m    \x1b[0m \n     \n     \n     \n     ";
+static const char preview_6_0[] PROGMEM =
+	"\x1b[7;36m   \x1b[0m  \n\x1b[7;30m  \x1b[36m \x1b[0m  \n     \n     \n     ";
+static const char preview_6_1[] PROGMEM =
+	"\x1b[7;30m \x1b[36m \x1b[0m   \n\x1b[7;30m \x1b[36m \x1b[0m   \n\x1b[7;36m  \x1b[0m   \n     \n     ";
+static const char preview_6_2[] PROGMEM =
+	"\x1b[7;36m \x1b[30m  \x1b[0m  \n\x1b[7;36m   \x1b[0m  \n     \n     \n     ";
+static const char preview_6_3[] PROGMEM =
+	"\x1b[7;36m  \x1b[0m   \n\x1b[7;36m \x1b[30m \x1b[0m   \n\x1b[7;36m \x1b[30m \x1b[0m   \n     \n     ";
+
+static const char* const preview_strings[NUM_BLOCKS_IN_LIBRARY][NUM_ROTATIONS] PROGMEM = {
+	{ preview_0_0, preview_0_0, preview_0_0, preview_0_0 },
+	{ preview_1_0, preview_1_1, preview_1_0, preview_1_1 },
+	{ preview_2_0, preview_2_0, preview_2_0, preview_2_0 },
+	{ preview_3_0, preview_3_1, preview_3_2, preview_3_3 },
+	{ preview_4_0, preview_4_1, preview_4_2, preview_4_3 },
+	{ preview_5_0, preview_5_1, preview_5_0, preview_5_1 },
+	{ preview_6_0, preview_6_1, preview_6_2, preview_6_3 }
+};
+
+#endif /* NEXT_BLOCK_PREVIEW_H_ */
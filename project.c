@@ -15,16 +15,20 @@
 #include "ledmatrix.h"
 #include "scrolling_char_display.h"
 #include "buttons.h"
+#include "input.h"
+#include "latency.h"
 #include "serialio.h"
+#include "serialinput.h"
+#include "hostctl.h"
+#include "scheduler.h"
+#include "idle.h"
 #include "terminalio.h"
 #include "score.h"
 #include "timer0.h"
 #include "timer1.h"
-#include "timer2.h"
+#include "seven_seg.h"
 #include "game.h"
-
-#define F_CPU 8000000L
-#include <util/delay.h>
+#include "telemetry.h"
 
 // Function prototypes - these are defined below (after main()) in the order
 // given here
@@ -32,11 +36,57 @@ void initialise_hardware(void);
 void splash_screen(void);
 void new_game(void);
 void play_game(void);
-void handle_game_over(void);
+uint8_t handle_game_over(void);
 void handle_new_lap(void);
+static void redraw_terminal(void);
+static void set_refresh_limits_for_baud(long baudrate);
+static void change_baud_rate(void);
+static void finish_baud_change(uint8_t confirmed);
+static uint8_t run_host_commands(void);
+static void update_flow_control(void);
+static uint8_t show_input_errors(uint8_t row);
+static void show_statistics(void);
+static void restart_gravity(void);
+
+// Baud rate used at startup
+#ifndef SERIAL_BAUD_RATE
+#define SERIAL_BAUD_RATE 19200
+#endif
+
+// Set to 1 to turn on XON/XOFF flow control of serial input. The XON and
+// XOFF characters can be sent in the middle of anything (see serialio.h),
+// which would corrupt binary telemetry messages and host control replies,
+// so flow control is turned off while telemetry is on and once a host
+// program has sent a command (see update_flow_control()).
+#ifndef SERIAL_FLOW_CONTROL
+#define SERIAL_FLOW_CONTROL 0
+#endif
 
-// ASCII code for Escape character
-#define ESCAPE_CHAR 27
+// Baud rates which the 'f' command steps through, and how long (ms) we
+// wait for the new rate to be confirmed before going back to the old one
+static const long baud_rates[] PROGMEM = { 19200, 38400, 76800, 250000 };
+#define NUM_BAUD_RATES (sizeof(baud_rates) / sizeof(baud_rates[0]))
+#define BAUD_CONFIRM_TIMEOUT 5000
+
+// Set while a baud rate change is waiting to be confirmed - with the rate
+// to go back to and when (clock ticks) to give up waiting
+static uint8_t baud_confirming;
+static long baud_old_rate;
+static uint32_t baud_confirm_deadline;
+
+/*
+ * Host control (see hostctl.h). host_lockstep is set when the host is in
+ * control of time - the block then only drops when the host sends STEP
+ * and host_time is the game time (ms) since the last of those drops.
+ * host_game_over is set when the game ends in lockstep mode - we then
+ * wait for the host to start another game.
+ */
+static uint8_t host_lockstep;
+static uint32_t host_time;
+static uint8_t host_game_over;
+
+// Set once a host program has sent a command (until power off)
+static uint8_t host_session;
 
 /////////////////////////////// main //////////////////////////////////
 int main(void) {
@@ -47,6 +97,9 @@ int main(void) {
 	//storage
 	manage_eeprom();
 	
+	// Find out what the terminal can do before we start drawing on it
+	terminal_probe_capabilities();
+	
 	// Show the splash screen message. Returns when display
 	// is complete
 	splash_screen();
@@ -54,14 +107,19 @@ int main(void) {
 	//initialise high score at 0
 	set_high_score(0);
 	
+	uint8_t game_started = 0;
 	while(1) {
-		//seed the random number generator
-		//multiply by 10 to get good spread
-		empty_button_queue();
-		srandom(get_clock_ticks()*10);
-		new_game();
+		//a host program may have started the next game itself (with its
+		//own seed) from the game over screen
+		if (!game_started) {
+			//seed the random number generator
+			//multiply by 10 to get good spread
+			input_reset();
+			srandom(get_clock_ticks()*10);
+			new_game();
+		}
 		play_game();
-		handle_game_over();
+		game_started = handle_game_over();
 	}
 }
 
@@ -69,25 +127,23 @@ void initialise_hardware(void) {
 	ledmatrix_setup();
 	init_button_interrupts();
 	
-	// Setup serial port for 19200 baud communication with no echo
-	// of incoming characters
-	init_serial_stdio(19200,0);
+	// Setup serial port for SERIAL_BAUD_RATE baud communication with no
+	// echo of incoming characters
+	init_serial_stdio(SERIAL_BAUD_RATE, 0);
+	update_flow_control();
+	set_refresh_limits_for_baud(SERIAL_BAUD_RATE);
 
 	// Set up our main timer to give us an interrupt every millisecond
 	init_timer0();
 	//play music
 	init_timer1();
-	//set up the secondary timer to keep the seven_seg_display *always* displaying two digits
-	init_timer2();	
+	//keep the seven_seg_display *always* displaying two digits (a timer 0
+	//soft timer)
+	init_seven_seg();
+	//sample the joystick in the background (triggered by timer 0)
+	init_joystick();
 	// Turn on global interrupts
 	sei();
-	
-	//set-up the joystick
-	ADMUX = (1<<REFS0);
-	ADCSRA = (1<<ADEN)|(1<<ADPS2)|(1<<ADPS1);	
-	
-	
-	
 }
 
 void splash_screen(void) {
@@ -97,22 +153,22 @@ void splash_screen(void) {
 	
 	hide_cursor();	// We don't need to see the cursor when we're just doing output
 	move_cursor(3,3);
-	printf_P(PSTR("Tetris"));
+	fputs_P(PSTR("Tetris"), stdout);
 	
 	move_cursor(3,5);
 	set_display_attribute(FG_GREEN);	// Make the text green
-	printf_P(PSTR("CSSE2010/7201 Tetris Project by Ben Gattas and Callum Bryson"));	
+	fputs_P(PSTR("CSSE2010/7201 Tetris Project by Ben Gattas and Callum Bryson"), stdout);	
 	set_display_attribute(FG_WHITE);	// Return to default colour (White)
 	
 	move_cursor(17,7);
-	printf_P(PSTR("High Scores: "));
+	fputs_P(PSTR("High Scores: "), stdout);
 	for (uint8_t i = 0; i < 5; i++) {
 		move_cursor(17, 8+i);
-		printf_P(PSTR("%10d"),get_eeprom_scores()[i]);
-		printf_P(PSTR(" "));
+		serial_put_uint32(get_eeprom_scores()[i], 10);
+		putchar(' ');
 		for (uint8_t j =0; j < 3; j++) {
 			char initialCharacter = get_eeprom_initial(i)[j];
-			printf("%c",initialCharacter);
+			putchar(initialCharacter);
 		}
 	}
 	
@@ -127,7 +183,10 @@ void splash_screen(void) {
 		// Scroll the message until it has scrolled off the 
 		// display or a button is pushed. We pause for 130ms between each scroll.
 		while(scroll_display()) {
-			_delay_ms(130);
+			uint16_t scroll_time = get_clock_ticks16() + 130;
+			while(!clock16_reached(get_clock_ticks16(), scroll_time)) {
+				idle_sleep();
+			}
 			if(button_pushed() != -1) {
 				// A button has been pushed
 				return;
@@ -147,16 +206,85 @@ void splash_screen(void) {
 void new_game(void) {
 	//switch music
 	switch_to_game_over(0);
+	host_game_over = 0;
 	
 	// Initialise the game and display
 	init_game();
 	
-	// Clear the serial terminal
-	clear_terminal();
-	
 	// Initialise the score
 	init_score();
 	
+	// Clear the serial terminal and draw the score, game area
+	// and next block
+	redraw_terminal();
+	
+	// Delete any pending button pushes or serial input
+	input_reset();
+	serial_input_reset();
+}
+
+// Send as much in each terminal refresh as the UART can send in the
+// refresh interval (10 bits per byte)
+static void set_refresh_limits_for_baud(long baudrate) {
+	long bytes = baudrate / 10 * TERMINAL_REFRESH_INTERVAL / 1000;
+	if(bytes > 250) {
+		bytes = 250;
+	}
+	terminal_set_refresh_limits(TERMINAL_REFRESH_INTERVAL, bytes);
+}
+
+/*
+ * Switch to the next baud rate in baud_rates. The user must then press 'y'
+ * at the new rate within BAUD_CONFIRM_TIMEOUT ms; if they don't (e.g.
+ * because their terminal can't use the new rate) we go back to the old
+ * rate. The game carries on meanwhile - the input task watches for the
+ * 'y' and the deadline and calls finish_baud_change(). Characters received
+ * with framing errors (as happens when the two ends use different rates)
+ * are discarded by the serial module.
+ */
+static void change_baud_rate(void) {
+	long new_baud = pgm_read_dword(&baud_rates[0]);
+	
+	baud_old_rate = serial_get_baud();
+	for(uint8_t i = 0; i < NUM_BAUD_RATES - 1; i++) {
+		if(pgm_read_dword(&baud_rates[i]) == baud_old_rate) {
+			new_baud = pgm_read_dword(&baud_rates[i+1]);
+		}
+	}
+	normal_display_mode();
+	move_cursor(3, 24);
+	fputs_P(PSTR("Switching to "), stdout);
+	serial_put_uint32(new_baud, 0);
+	fputs_P(PSTR(" baud - press 'y' to confirm"), stdout);
+	clear_to_end_of_line();
+	serial_set_baud(new_baud);
+	set_refresh_limits_for_baud(new_baud);
+	clear_serial_input_buffer();
+	
+	baud_confirming = 1;
+	baud_confirm_deadline = get_clock_ticks() + BAUD_CONFIRM_TIMEOUT;
+}
+
+// Keep the new baud rate (if confirmed) or go back to the old one
+static void finish_baud_change(uint8_t confirmed) {
+	baud_confirming = 0;
+	if(!confirmed) {
+		serial_set_baud(baud_old_rate);
+		set_refresh_limits_for_baud(baud_old_rate);
+	}
+	
+	// Whatever the terminal showed, it needs redrawing
+	redraw_terminal();
+	move_cursor(3, 24);
+	fputs_P(PSTR("Baud rate: "), stdout);
+	serial_put_uint32(serial_get_baud(), 0);
+}
+
+static void redraw_terminal(void) {
+	// Clear the serial terminal
+	clear_terminal();
+	hide_cursor();
+	
 	//display score
 	display_score(get_score());
 	
@@ -165,245 +293,432 @@ void new_game(void) {
 	
 	//display initial next block
 	initial_display_next_block();
-	
-	// Delete any pending button pushes or serial input
-	empty_button_queue();
-	clear_serial_input_buffer();
 }
 
-void play_game(void) {
-	uint32_t last_drop_time, last_term_time, last_input_time;
-	int8_t button, game_paused, last_button, joystick, last_joystick;
-	char serial_input, escape_sequence_char;
-	uint8_t characters_into_escape_sequence = 0;
-	
-	int firstRepeat = 0;
-	last_button = -2;
-	last_joystick = get_most_recent_joystick();
-	
-	// Record the last time a block was dropped as the current time -
-	// this ensures we don't drop a block immediately.
-	last_drop_time = get_clock_ticks();
-	last_input_time = get_clock_ticks();
-	last_term_time = get_clock_ticks();
-	
-	// We play the game forever. If the game is over, we will break out of
-	// this loop. The loop checks for events (button pushes, serial input etc.)
-	// and on a regular basis will drop the falling block down by one row.
-	while(1) {
-		
-		//update serial display
-		if(get_clock_ticks() > last_term_time + 100) {
-			fast_terminal_draw();
-			last_term_time = get_clock_ticks();
-		}
-		
-		
-		// Check for input - which could be a button push or serial input.
-		// Serial input may be part of an escape sequence, e.g. ESC [ D
-		// is a left cursor key press. We will be processing each character
-		// independently and can't do anything until we get the third character.
-		// At most one of the following three variables will be set to a value 
-		// other than -1 if input is available.
-		// (We don't initalise button to -1 since button_pushed() will return -1
-		// if no button pushes are waiting to be returned.)
-		// Button pushes take priority over serial input. If there are both then
-		// we'll retrieve the serial input the next time through this loop
-		serial_input = -1;
-		escape_sequence_char = -1;
-		button = button_pushed();
-		joystick = joystick_input();
-			
-		//check if last button pressed or joystick input was the same as this one
-		if ((last_button == button) && (button != -1)) {
-			if (firstRepeat == 0) {
-				if (get_clock_ticks() >= last_input_time + 500) {
-					if(button==3 || escape_sequence_char=='D') {
-						// Attempt to move left
-						(void)attempt_move(MOVE_LEFT);
-					} else if(button==0 || escape_sequence_char=='C') {
-						// Attempt to move right
-						(void)attempt_move(MOVE_RIGHT);
-					} else if (button==2 || escape_sequence_char == 'A') {
-						// Attempt to rotate
-						(void)attempt_rotation();
-					}
-					firstRepeat = 1;
-				}
-			} else {
-				if (get_clock_ticks() >= last_input_time + 50) {
-					if(button==3 || escape_sequence_char=='D') {
-						// Attempt to move left
-						(void)attempt_move(MOVE_LEFT);
-					} else if(button==0 || escape_sequence_char=='C') {
-						// Attempt to move right
-						(void)attempt_move(MOVE_RIGHT);
-					} else if (button==2 || escape_sequence_char == 'A') {
-						// Attempt to rotate
-						(void)attempt_rotation();
-					}
-				}
+// Carry out a command, returning the status to acknowledge it with
+static uint8_t host_command(HostCommand* command) {
+	uint8_t* payload = command->payload;
+	
+	switch(command->type) {
+		case HOSTCTL_CMD_STEP:
+			if(command->length != 2) {
+				return HOSTCTL_BAD_COMMAND;
 			}
-			
-		} else if ((last_joystick == joystick) && (joystick != -1)){
-			if (firstRepeat == 0) {
-				if (get_clock_ticks() >= last_input_time + 500) {
-					if(joystick==3) {
-						// Attempt to move left
-						(void)attempt_move(MOVE_LEFT);
-					} else if(joystick==0) {
-						// Attempt to move right
-						(void)attempt_move(MOVE_RIGHT);
-					} else if (joystick==2) {
-						// Attempt to rotate
-						(void)attempt_rotation();
-					}
-					firstRepeat = 1;
-				}
-			} else {
-				if (get_clock_ticks() >= last_input_time + 50) {
-					if (joystick==3) {
-						// Attempt to move left
-						(void)attempt_move(MOVE_LEFT);
-					} else if (joystick==0) {
-						// Attempt to move right
-						(void)attempt_move(MOVE_RIGHT);
-					} else if (joystick==2) {
-						// Attempt to rotate
-						(void)attempt_rotation();
-					}
-				}
+			if(host_game_over) {
+				return HOSTCTL_GAME_OVER;
 			}
-			
-		
-		} else {
-			last_input_time = get_clock_ticks();
-			last_button = button;
-			last_joystick = joystick;
-			firstRepeat = 0;		
-			if(button == -1) {
-				// No push button was pushed, see if there is any serial input
-				if(serial_input_available()) {
-					// Serial data was available - read the data from standard input
-					serial_input = fgetc(stdin);
-					// Check if the character is part of an escape sequence
-					if(characters_into_escape_sequence == 0 && serial_input == ESCAPE_CHAR) {
-						// We've hit the first character in an escape sequence (escape)
-						characters_into_escape_sequence++;
-						serial_input = -1; // Don't further process this character
-					} else if(characters_into_escape_sequence == 1 && serial_input == '[') {
-						// We've hit the second character in an escape sequence
-						characters_into_escape_sequence++;
-						serial_input = -1; // Don't further process this character
-					} else if(characters_into_escape_sequence == 2) {
-						// Third (and last) character in the escape sequence
-						escape_sequence_char = serial_input;
-						serial_input = -1;  // Don't further process this character - we
-											// deal with it as part of the escape sequence
-						characters_into_escape_sequence = 0;
-					} else {
-						// Character was not part of an escape sequence (or we received
-						// an invalid second character in the sequence). We'll process 
-						// the data in the serial_input variable.
-						characters_into_escape_sequence = 0;
-					}
+			host_time += payload[0] | (payload[1] << 8);
+			while(host_time >= get_drop_interval()) {
+				host_time -= get_drop_interval();
+				if(!drop_or_fix_block()) {
+					host_game_over = 1;
+					return HOSTCTL_GAME_OVER;
 				}
 			}
-			// Process the input. 
-			if(button==3 || escape_sequence_char=='D' || joystick==3) {
-				// Attempt to move left
-				(void)attempt_move(MOVE_LEFT);
-			} else if(button==0 || escape_sequence_char=='C' || joystick==0) {
-				// Attempt to move right
-				(void)attempt_move(MOVE_RIGHT);
-			} else if (button==2 || escape_sequence_char == 'A' || joystick==2) {
-				// Attempt to rotate
-				(void)attempt_rotation();
-			} else if (button==1 || escape_sequence_char == 'B' || joystick==1) {
-				// Attempt to drop block 
-				drop:if(!attempt_drop_block_one_row()) {
-						// Drop failed - fix block to board and add new block
-						if(!fix_block_to_board_and_add_new_block()) {
-							break;	// GAME OVER
-						}
-				} else {
-					add_to_score(1); //block dropped
-					//ADDED FUNCTIONALITY - repeat until can no longer be dropped
-					goto drop;
-					//display score
-					display_score(get_score());
-				}
-				last_drop_time = get_clock_ticks();
-			} else if(serial_input == 'p' || serial_input == 'P') {
-				// pause/un-pause the game until 'p' or 'P' is pressed again.
-				// All other input (buttons, serial etc.) must be ignored. Except new game.
-				game_paused = 1;
-				//stop the game timer (see timer0.c for implementation of toggle_timer)
-				toggle_timer();
-				while (game_paused) {
-					//wait for only a 'p' or an 'n' to come through
-					if (serial_input_available()) {
-						serial_input = fgetc(stdin);
-						if (serial_input == 'p' || serial_input == 'P') {
-							game_paused = 0;
-						}
-						if (serial_input == 'n' || serial_input == 'N') {
-							game_paused = 0;
-							new_game();
-						}
+			return HOSTCTL_OK;
+		case HOSTCTL_CMD_ACTION:
+			if(command->length != 1) {
+				return HOSTCTL_BAD_COMMAND;
+			}
+			if(host_game_over) {
+				return HOSTCTL_GAME_OVER;
+			}
+			switch(payload[0]) {
+				case ACTION_LEFT:
+					return attempt_move(MOVE_LEFT) ? HOSTCTL_OK : HOSTCTL_FAILED;
+				case ACTION_RIGHT:
+					return attempt_move(MOVE_RIGHT) ? HOSTCTL_OK : HOSTCTL_FAILED;
+				case ACTION_ROTATE:
+					return attempt_rotation() ? HOSTCTL_OK : HOSTCTL_FAILED;
+				case ACTION_DROP:
+					if(!hard_drop_block()) {
+						host_game_over = 1;
+						return HOSTCTL_GAME_OVER;
 					}
+					// The next block gets a whole drop interval, as when
+					// the drop comes from a button
+					restart_gravity();
+					return HOSTCTL_OK;
+				default:
+					return HOSTCTL_BAD_COMMAND;
+			}
+		case HOSTCTL_CMD_QUERY:
+			if(command->length != 0) {
+				return HOSTCTL_BAD_COMMAND;
+			}
+			return host_game_over ? HOSTCTL_GAME_OVER : HOSTCTL_OK;
+		case HOSTCTL_CMD_REPEAT:
+			if(command->length != 4) {
+				return HOSTCTL_BAD_COMMAND;
+			}
+			input_set_repeat(payload[0] | (payload[1] << 8),
+					payload[2] | (payload[3] << 8));
+			return HOSTCTL_OK;
+		case HOSTCTL_CMD_PLACE:
+			if(command->length != 3) {
+				return HOSTCTL_BAD_COMMAND;
+			}
+			if(host_game_over) {
+				return HOSTCTL_GAME_OVER;
+			}
+			if(!attempt_placement(payload[0], payload[1])) {
+				return HOSTCTL_FAILED;
+			}
+			if(payload[2] & HOSTCTL_PLACE_DROP) {
+				if(!hard_drop_block()) {
+					host_game_over = 1;
+					return HOSTCTL_GAME_OVER;
 				}
-				//restart the game timer
-				toggle_timer();
-			} else if(serial_input == 'n' || serial_input == 'N') {
-				//reset the game state and begin a new game
-				//TO DO LATER: save high-score here
-				new_game();
-			} else if(serial_input == 's' || serial_input == 'S') {
-				//save the game state
-				save_game();
-			} else if(serial_input == 'o' || serial_input == 'O') {
-				load_game();
+				restart_gravity();
+			}
+			return HOSTCTL_OK;
+		case HOSTCTL_CMD_SEED:
+			if(command->length != 5) {
+				return HOSTCTL_BAD_COMMAND;
 			}
+			srandom(payload[0] | ((uint32_t)payload[1] << 8) |
+					((uint32_t)payload[2] << 16) | ((uint32_t)payload[3] << 24));
+			host_lockstep = payload[4] & HOSTCTL_LOCKSTEP;
+			host_time = 0;
+			new_game();
+			return HOSTCTL_OK;
+		default:
+			return HOSTCTL_BAD_COMMAND;
+	}
+}
+
+/*
+ * Carry out and acknowledge the commands waiting from the host. Returns 0
+ * if a command ended the game (and the host isn't in lockstep mode, when
+ * the game stays over until the host starts a new one), 1 otherwise.
+ */
+static uint8_t run_host_commands(void) {
+	HostCommand command;
+	
+	while(hostctl_next_command(&command)) {
+		if(!host_session) {
+			host_session = 1;
+			update_flow_control();
 		}
-		// else - invalid input or we're part way through an escape sequence -
-		// do nothing
-		
-		// Check for timer related events here
-		uint16_t num_ticks = 600;
-		if (get_row_count() < 30) {
-			num_ticks = 600 - (get_row_count()*20);
-		} else {
-			num_ticks = 20;
+		hostctl_acknowledge(&command, host_command(&command));
+		if(host_game_over && !host_lockstep) {
+			return 0;
 		}
-		
-		if(get_clock_ticks() >= last_drop_time + num_ticks) {
-			// 600ms (0.6 second) has passed since the last time we dropped
-			// a block, so drop it now.
-			if(!attempt_drop_block_one_row()) {
-				// Drop failed - fix block to board and add new block
-				if(!fix_block_to_board_and_add_new_block()) {
-					break;	// GAME OVER
+	}
+	return 1;
+}
+
+/*
+ * Show the counts of input lost since power on, starting at the given row.
+ * UART is characters lost because the serial input buffer was full (see
+ * serialio.h), commands is typed commands lost because their queue was
+ * full (see serialinput.h), events is button, joystick and cursor key
+ * events lost because the input event queue was full (see input.h) and
+ * bad frames is host control frames thrown away (see hostctl.h).
+ * Malformed is escape sequences which were cut short or too long (see
+ * serialinput.h). Returns the row after the last one printed.
+ */
+static uint8_t show_input_errors(uint8_t row) {
+	normal_display_mode();
+	move_cursor(3, row++);
+	serial_write_P(
+			PSTR("Input errors    UART  commands    events  bad frames  malformed"));
+	clear_to_end_of_line();
+	move_cursor(17, row++);
+	serial_put_uint32(serial_receive_overruns(), 6);
+	serial_put_uint32(serial_input_overruns(), 10);
+	serial_put_uint32(input_overruns(), 10);
+	serial_put_uint32(hostctl_errors(), 12);
+	serial_put_uint32(serial_input_malformed(), 11);
+	clear_to_end_of_line();
+	return row;
+}
+
+/*
+ * Show the statistics on a screen of their own (they don't fit below the
+ * game) until a key, button or joystick is pressed, then redraw the game. The clock
+ * is stopped meanwhile, as when the game is paused.
+ */
+static void show_statistics(void) {
+	uint8_t row;
+	
+	serial_set_output_policy(SERIAL_OUTPUT_BLOCK);
+	toggle_timer();
+	clear_terminal();
+	row = latency_dump(2);
+	row = scheduler_dump(row + 1);
+	row = show_input_errors(row + 1);
+	move_cursor(3, row + 1);
+	serial_write_P(PSTR("Press a key to continue"));
+	
+	input_reset();
+	serial_input_reset();
+	while(serial_input_action() == -1 && input_next_action() == -1) {
+		serial_input_poll();
+		idle_sleep();
+	}
+	
+	toggle_timer();
+	input_reset();
+	redraw_terminal();
+	serial_set_output_policy(SERIAL_OUTPUT_DROP);
+}
+
+// Use XON/XOFF flow control (if SERIAL_FLOW_CONTROL is set) only while
+// the serial output is all text
+static void update_flow_control(void) {
+	serial_set_flow_control(SERIAL_FLOW_CONTROL && !host_session &&
+			telemetry_get_mode() == TELEMETRY_OFF);
+}
+
+/*
+ * Game tasks (see scheduler.h). Input is polled - button pushes, joystick
+ * movements and serial input are all waiting in queues filled by
+ * interrupt handlers, so the input task just checks those. Dropping the
+ * block (gravity) and updating the terminal happen every so often. (The
+ * LED matrix is updated as soon as the board changes, and the seven
+ * segment display and music are run by their own timer interrupts.)
+ * Any task can end the game with scheduler_stop().
+ */
+static int8_t gravity_task_id;
+
+// Start the drop interval again from now (e.g. after a hard drop)
+static void restart_gravity(void) {
+	scheduler_set_period(gravity_task_id, get_drop_interval());
+	scheduler_restart(gravity_task_id);
+}
+
+static void input_task(void) {
+	int8_t action, game_paused;
+	char serial_input;
+	
+	// Check whether the last terminal update has been sent (for timing
+	// input latency - see latency.h)
+	latency_poll();
+	
+	// Read and decode all the serial input which has arrived (so the
+	// serial input buffer can't overflow) - see serialinput.h
+	serial_input_poll();
+	
+	// Give up on a baud rate change which hasn't been confirmed in time
+	if(baud_confirming &&
+			clock_reached(get_clock_ticks(), baud_confirm_deadline)) {
+		serial_set_output_policy(SERIAL_OUTPUT_BLOCK);
+		finish_baud_change(0);
+		serial_set_output_policy(SERIAL_OUTPUT_DROP);
+	}
+	
+	// Carry out any commands from a host program
+	if(!run_host_commands()) {
+		scheduler_stop();	// GAME OVER
+		return;
+	}
+	if(host_game_over) {
+		return;	// wait for the host to start a new game
+	}
+	
+	// Check for input. Button pushes, joystick movements and cursor
+	// keys all come from the input event queue - input_next_action()
+	// returns the next of those (or an auto repeat of a button or
+	// joystick direction being held down). Other keys typed at the
+	// terminal (commands) are taken from the serial input queue if
+	// there's no action.
+	serial_input = -1;
+	action = input_next_action();
+	if(action == -1) {
+		serial_input = serial_input_action();
+	}
+	if(baud_confirming && serial_input != -1) {
+		//while a new baud rate is being tried, typed characters may
+		//be garbled - only 'y' (to confirm it) counts
+		if(serial_input == 'y' || serial_input == 'Y') {
+			serial_set_output_policy(SERIAL_OUTPUT_BLOCK);
+			finish_baud_change(1);
+			serial_set_output_policy(SERIAL_OUTPUT_DROP);
+		}
+		scheduler_busy();
+		return;
+	}
+	if(action == -1 && serial_input == -1) {
+		return;	// nothing to do
+	}
+	scheduler_busy();
+	
+	// Process the input. 
+	// (Inputs which change the board are timed until the change
+	// reaches the terminal - see latency.h)
+	if(action == ACTION_LEFT) {
+		// Attempt to move left
+		if(attempt_move(MOVE_LEFT)) {
+			latency_board_changed();
+		}
+	} else if(action == ACTION_RIGHT) {
+		// Attempt to move right
+		if(attempt_move(MOVE_RIGHT)) {
+			latency_board_changed();
+		}
+	} else if(action == ACTION_ROTATE) {
+		// Attempt to rotate
+		if(attempt_rotation()) {
+			latency_board_changed();
+		}
+	} else if(action == ACTION_DROP) {
+		// Drop block until it can no longer be dropped (a point
+		// per row) then fix it to the board and add a new block
+		if(!hard_drop_block()) {
+			scheduler_stop();	// GAME OVER
+			return;
+		}
+		latency_board_changed();
+		restart_gravity();
+	} else if(serial_input == 'p' || serial_input == 'P') {
+		// pause/un-pause the game until 'p' or 'P' is pressed again.
+		// All other input (buttons, serial etc.) must be ignored. Except new game.
+		game_paused = 1;
+		//stop the game timer (see timer0.c for implementation of toggle_timer)
+		toggle_timer();
+		while (game_paused) {
+			//wait for only a 'p' or an 'n' to come through
+			serial_input_poll();
+			serial_input = serial_input_action();
+			if (serial_input != -1) {
+				if (serial_input == 'p' || serial_input == 'P') {
+					game_paused = 0;
+				}
+				if (serial_input == 'n' || serial_input == 'N') {
+					game_paused = 0;
+					new_game();
 				}
+			} else {
+				//the clock is stopped - wait for serial input
+				idle_sleep();
 			}
-			last_drop_time = get_clock_ticks();
 		}
+		//restart the game timer, ignoring anything pushed while
+		//we were paused
+		toggle_timer();
+		input_reset();
+	} else if(serial_input == 'n' || serial_input == 'N') {
+		//reset the game state and begin a new game
+		//TO DO LATER: save high-score here
+		new_game();
+	} else if(serial_input == 's' || serial_input == 'S') {
+		//save the game state
+		save_game();
+	} else if(serial_input == 'o' || serial_input == 'O') {
+		load_game();
+	} else if(serial_input == 't' || serial_input == 'T') {
+		//switch between the ANSI terminal display and the
+		//binary telemetry stream (see telemetry.h)
+		telemetry_set_mode((telemetry_get_mode() + 1) % TELEMETRY_NUM_MODES);
+		update_flow_control();
+		if(telemetry_get_mode() == TELEMETRY_OFF) {
+			redraw_terminal();
+		}
+		terminal_board_changed();
+	} else if(serial_input == 'l' || serial_input == 'L') {
+		//show the input latency and task timing statistics (see
+		//latency.h and scheduler.h)
+		show_statistics();
+	} else if(serial_input == 'i' || serial_input == 'I') {
+		//show how much of the time the CPU has been asleep since this
+		//was last asked for (see idle.h)
+		serial_set_output_policy(SERIAL_OUTPUT_BLOCK);
+		//(on the bottom line, as for the baud rate)
+		normal_display_mode();
+		move_cursor(3, 24);
+		fputs_P(PSTR("CPU idle: "), stdout);
+		serial_put_uint32(idle_percent(), 0);
+		putchar('%');
+		clear_to_end_of_line();
+		serial_set_output_policy(SERIAL_OUTPUT_DROP);
+	} else if(serial_input == 'f' || serial_input == 'F') {
+		//try a faster (or wrap back to the slowest) baud rate -
+		//the prompts must get through
+		serial_set_output_policy(SERIAL_OUTPUT_BLOCK);
+		change_baud_rate();
+		serial_set_output_policy(SERIAL_OUTPUT_DROP);
+	}
+	// else - no input or invalid input - do nothing
+}
+
+static void gravity_task(void) {
+	// When a host program is in control of time, the block only drops
+	// when it says so
+	if(host_lockstep || host_game_over) {
+		return;
+	}
+	if(!drop_or_fix_block()) {
+		scheduler_stop();	// GAME OVER
+		return;
+	}
+	// The drop interval gets shorter as the game goes on
+	scheduler_set_period(gravity_task_id, get_drop_interval());
+}
+
+static void terminal_task(void) {
+	if(terminal_resync_needed()) {
+		redraw_terminal();
+	}
+	
+	//update serial display - only when the board has changed (this
+	//task runs every terminal refresh interval)
+	if(terminal_refresh_pending()) {
+		fast_terminal_draw();
+		//(the frame may have been cut short - the change has only
+		//reached the terminal once nothing is left to draw)
+		if(!terminal_refresh_pending()) {
+			latency_terminal_drawn();
+		}
+	}
+}
+
+void play_game(void) {
+	// Never wait for the UART while playing - output which doesn't fit in
+	// the serial output buffer is dropped and the terminal is redrawn
+	// (see terminal_resync_needed()) once there's room again
+	serial_set_output_policy(SERIAL_OUTPUT_DROP);
+	
+	// The first drop is one drop interval from now. We play the game
+	// until one of the tasks finds that the game is over.
+	scheduler_init();
+	scheduler_add(PSTR("input"), input_task, 0);
+	gravity_task_id = scheduler_add(PSTR("gravity"), gravity_task,
+			get_drop_interval());
+	scheduler_add(PSTR("terminal"), terminal_task,
+			terminal_refresh_interval());
+	scheduler_run();
+	
+	// If we get here the game is over. Everything from here on (game over
+	// messages, high scores) must be seen.
+	serial_set_output_policy(SERIAL_OUTPUT_BLOCK);
+	
+	// A baud rate change which hasn't been confirmed is abandoned
+	if(baud_confirming) {
+		finish_baud_change(0);
 	}
-	// If we get here the game is over. 
 }
 
-void handle_game_over() {
+/*
+ * Show the game over screen and wait for a button (or 'n') to start again.
+ * Host commands are still carried out - returns 1 if a host program
+ * started a new game (with SEED), 0 otherwise.
+ */
+uint8_t handle_game_over(void) {
 	switch_to_game_over(1);
-	empty_button_queue();
+	input_reset();
+	// Host commands get HOSTCTL_GAME_OVER until one starts a new game
+	host_game_over = 1;
 	move_cursor(17,14);
 	// Print a message to the terminal. 
-	printf_P(PSTR("GAME OVER"));
+	fputs_P(PSTR("GAME OVER"), stdout);
 	//output current high score
 	if (get_score() > get_high_score()) {
 		set_high_score(get_score());
 	}
 	move_cursor(17,15);
-	printf_P(PSTR("HIGH SCORE: %d"), get_high_score());
+	fputs_P(PSTR("HIGH SCORE: "), stdout);
+	serial_put_uint32(get_high_score(), 0);
 	uint8_t new_best_score = 0;
 	//check for new high score
 	uint8_t index;
@@ -414,10 +729,11 @@ void handle_game_over() {
 			break;
 		}
 	}
-	if (new_best_score == 1) {
-		//input a new best score
+	if (new_best_score == 1 && !host_session) {
+		//input a new best score (not when a host program is playing - the
+		//initials would be read from its commands)
 		move_cursor(17,17);
-		printf_P(PSTR("Enter initials: "));
+		fputs_P(PSTR("Enter initials: "), stdout);
 		show_cursor();
 		static char initials[3];
 		uint8_t initial_num = 0;
@@ -426,7 +742,7 @@ void handle_game_over() {
 			if (serial_input_available()) {
 				char input = fgetc(stdin);
 				initials[initial_num] = input;
-				printf("%c", input);
+				putchar(input);
 				initial_num++;
 			}
 			if (initial_num > 2) {
@@ -438,38 +754,41 @@ void handle_game_over() {
 				store_eeprom_score(get_score(), index);
 				break;
 			}
-			if (get_clock_ticks() > time_since_wait + 10000) {
+			if (clock_reached(get_clock_ticks(), time_since_wait + 10000)) {
 				break;
 			}
+			idle_sleep();
 		}
 		hide_cursor();
 		
 	}
 	move_cursor(17,18);
-	printf_P(PSTR("High Scores: "));
+	fputs_P(PSTR("High Scores: "), stdout);
 	move_cursor(17,19);
 	for (uint8_t i = 0; i < 5; i++) {
 		move_cursor(17, 19+i);
-		printf_P(PSTR("%10d"),get_eeprom_scores()[i]);
-		printf_P(PSTR(" "));
+		serial_put_uint32(get_eeprom_scores()[i], 10);
+		putchar(' ');
 		for (uint8_t j =0; j < 3; j++) {
 			char initialCharacter = get_eeprom_initial(i)[j];
-			printf("%c",initialCharacter);
+			putchar(initialCharacter);
 		}
 	move_cursor(17,17);
-	printf_P(PSTR("Press a button to start again"));
+	fputs_P(PSTR("Press a button to start again"), stdout);
 		
 	}
 	while(button_pushed() == -1) {
-		if (serial_input_available()) {
-			char serial_input = fgetc(stdin);
-			if (serial_input == 'n' || serial_input == 'N') {
-				break;
-			}
-
+		serial_input_poll();
+		run_host_commands();
+		if (!host_game_over) {
+			return 1;	// a host program has started a new game
+		}
+		char serial_input = serial_input_action();
+		if (serial_input == 'n' || serial_input == 'N') {
+			break;
 		}
-		; // wait until a button has been pushed
+		idle_sleep(); // wait until a button has been pushed
 	}
-	
+	return 0;
 }
 
@@ -0,0 +1,164 @@
+/*
+ * scheduler.c
+ *
+ * Cooperative scheduler - see scheduler.h.
+ */
+
+#include <stdint.h>
+
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+
+#include "scheduler.h"
+#include "idle.h"
+#include "serialio.h"
+#include "terminalio.h"
+#include "timer0.h"
+
+typedef struct {
+	const char* name;		// in program memory
+	Task task;
+	uint16_t period;		// 0 if polled
+	uint32_t deadline;		// clock ticks when next due
+	uint16_t runs;
+	uint16_t overruns;
+	uint16_t max_late;		// ms
+	uint16_t max_time;		// ms
+} TaskEntry;
+
+static TaskEntry tasks[SCHEDULER_MAX_TASKS];
+static uint8_t num_tasks;
+static uint8_t running;
+static uint8_t busy;
+
+void scheduler_init(void) {
+	num_tasks = 0;
+}
+
+int8_t scheduler_add(const char* name, Task task, uint16_t period) {
+	if(num_tasks == SCHEDULER_MAX_TASKS) {
+		return -1;
+	}
+	TaskEntry* entry = &tasks[num_tasks];
+	entry->name = name;
+	entry->task = task;
+	entry->period = period;
+	entry->deadline = get_clock_ticks() + period;
+	entry->runs = 0;
+	entry->overruns = 0;
+	entry->max_late = 0;
+	entry->max_time = 0;
+	return num_tasks++;
+}
+
+void scheduler_set_period(int8_t task, uint16_t period) {
+	tasks[task].period = period;
+}
+
+void scheduler_restart(int8_t task) {
+	tasks[task].deadline = get_clock_ticks() + tasks[task].period;
+}
+
+// Run a task and update its statistics. late is how long (ms) after its
+// deadline it is being run.
+static void run_task(TaskEntry* entry, uint32_t now, uint32_t late) {
+	entry->task();
+
+	uint32_t time = get_clock_ticks() - now;
+	if(entry->runs != UINT16_MAX) {
+		entry->runs++;
+	}
+	if(late > entry->max_late) {
+		entry->max_late = (late > UINT16_MAX) ? UINT16_MAX : late;
+	}
+	if(time > entry->max_time) {
+		entry->max_time = (time > UINT16_MAX) ? UINT16_MAX : time;
+	}
+}
+
+void scheduler_run(void) {
+	running = 1;
+	while(running) {
+		uint32_t now = get_clock_ticks();
+		TaskEntry* due = NULL;
+
+		// Find the timed task with the earliest deadline which has
+		// passed
+		for(uint8_t i = 0; i < num_tasks; i++) {
+			TaskEntry* entry = &tasks[i];
+			if(entry->period && clock_reached(now, entry->deadline) &&
+					(due == NULL ||
+					!clock_reached(entry->deadline, due->deadline))) {
+				due = entry;
+			}
+		}
+
+		if(due) {
+			uint32_t late = now - due->deadline;
+
+			// Work out the next deadline before running the task, so that
+			// the task can restart itself or change its period
+			if(late >= due->period) {
+				if(due->overruns != UINT16_MAX) {
+					due->overruns++;
+				}
+				due->deadline = now + due->period;
+			} else {
+				due->deadline += due->period;
+			}
+			run_task(due, now, late);
+			continue;
+		}
+
+		// Nothing is due - poll. If none of the polled tasks found
+		// anything to do, sleep until the next interrupt (at most a
+		// millisecond away).
+		busy = 0;
+		for(uint8_t i = 0; i < num_tasks && running; i++) {
+			if(tasks[i].period == 0) {
+				run_task(&tasks[i], now, 0);
+			}
+		}
+		if(!busy && running) {
+			idle_sleep();
+		}
+	}
+}
+
+void scheduler_busy(void) {
+	busy = 1;
+}
+
+void scheduler_stop(void) {
+	running = 0;
+}
+
+uint8_t scheduler_dump(uint8_t row) {
+	normal_display_mode();
+	move_cursor(3, row++);
+	serial_write_P(
+			PSTR("Task        period    runs overruns max late max time"));
+	clear_to_end_of_line();
+	for(uint8_t i = 0; i < num_tasks; i++) {
+		TaskEntry* entry = &tasks[i];
+
+		move_cursor(3, row++);
+		serial_write_P(entry->name);
+		move_cursor(13, row - 1);
+		if(entry->period) {
+			serial_put_uint32(entry->period, 8);
+		} else {
+			serial_write_P(PSTR("    poll"));
+		}
+		serial_put_uint32(entry->runs, 8);
+		serial_put_uint32(entry->overruns, 9);
+		serial_put_uint32(entry->max_late, 9);
+		serial_put_uint32(entry->max_time, 9);
+		clear_to_end_of_line();
+		entry->runs = 0;
+		entry->overruns = 0;
+		entry->max_late = 0;
+		entry->max_time = 0;
+	}
+	return row;
+}
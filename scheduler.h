@@ -0,0 +1,71 @@
+/*
+ * scheduler.h
+ *
+ * A small cooperative scheduler for the main program. A task is a
+ * function and a period (ms). Each task has a deadline - when it is next
+ * due - and the scheduler always runs whichever due task has the earliest
+ * deadline. A task runs to completion before anything else is run, so
+ * tasks must be short. After a task has run its next deadline is one
+ * period after this one (not after when it actually ran), so tasks don't
+ * drift - unless the task was run a whole period or more late. That is
+ * counted as an overrun and the task is next due one period from now
+ * (we don't run it several times to catch up).
+ *
+ * Tasks with a period of 0 are polled - they are run every time round the
+ * scheduler when no timed task is due. They are for tasks which check
+ * for something to do (e.g. input) and return straight away if there
+ * isn't anything. A polled task which did something calls
+ * scheduler_busy(), as there may be more to do. If none of them did, the
+ * CPU sleeps until the next interrupt (see idle.h).
+ *
+ * For each task we keep the number of times it has run, the number of
+ * overruns, the latest it has been run (ms after its deadline) and the
+ * longest it has taken to run (ms). These are shown by scheduler_dump().
+ */
+
+#ifndef SCHEDULER_H_
+#define SCHEDULER_H_
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+
+#define SCHEDULER_MAX_TASKS 6
+
+typedef void (*Task)(void);
+
+// Remove all the tasks
+void scheduler_init(void);
+
+/*
+ * Add a task called name (a string in program memory - used by
+ * scheduler_dump()) which runs every period ms, starting one period from
+ * now (or is polled, if period is 0). Returns the task number, which is
+ * used to change the task later, or -1 if there are already
+ * SCHEDULER_MAX_TASKS tasks.
+ */
+int8_t scheduler_add(const char* name, Task task, uint16_t period);
+
+// Change the period of a task. Takes effect after the task next runs.
+void scheduler_set_period(int8_t task, uint16_t period);
+
+// Make a task next due one period from now
+void scheduler_restart(int8_t task);
+
+// Run tasks until scheduler_stop() is called (by one of them)
+void scheduler_run(void);
+
+// Called by a polled task which found something to do - it will be polled
+// again rather than the CPU going to sleep
+void scheduler_busy(void);
+
+// Make scheduler_run() return once the current task has finished
+void scheduler_stop(void);
+
+/*
+ * Print the task statistics at the terminal, starting at the given row
+ * (one row, then one for each task), then start them again. Returns the
+ * row after the last one printed.
+ */
+uint8_t scheduler_dump(uint8_t row);
+
+#endif /* SCHEDULER_H_ */
@@ -0,0 +1,194 @@
+/*
+ * serialinput.c
+ *
+ * Serial input decoder - see serialinput.h.
+ *
+ * Escape sequences are recognised with a table driven state machine. Each
+ * character is put into a class, and transitions[state][class] gives the
+ * next state and what to do with the character. The sequences we accept
+ * are ESC [ (parameters/intermediates) final and ESC O final - anything
+ * else after an ESC is malformed. When a sequence is abandoned the
+ * character which broke it is processed again from STATE_GROUND (so
+ * e.g. a second ESC starts a new sequence, as it did before).
+ */
+
+#include <stdint.h>
+
+#include <avr/pgmspace.h>
+
+#include "serialinput.h"
+#include "serialio.h"
+#include "hostctl.h"
+#include "input.h"
+
+#define ESCAPE_CHAR 27
+
+// States
+#define STATE_GROUND 0		// not in an escape sequence
+#define STATE_ESCAPE 1		// had ESC
+#define STATE_CSI 2			// had ESC [
+#define STATE_SS3 3			// had ESC O
+#define NUM_STATES 4
+
+// Character classes
+#define CLASS_ESCAPE 0		// ESC
+#define CLASS_CSI 1			// '['
+#define CLASS_SS3 2			// 'O'
+#define CLASS_PARAMETER 3	// '0' to '?'
+#define CLASS_INTERMEDIATE 4	// ' ' to '/'
+#define CLASS_FINAL 5		// '@' to '~' (other than '[' and 'O')
+#define CLASS_CONTROL 6		// other control characters, DEL, 8 bit
+#define NUM_CLASSES 7
+
+// What to do with the character
+#define DO_NOTHING 0
+#define DO_KEY 1			// queue it (if printable)
+#define DO_COLLECT 2		// part of the sequence - check the length
+#define DO_DISPATCH 3		// final character of a sequence
+#define DO_ABANDON 4		// sequence is malformed - start again
+
+#define T(state, action) (((state) << 4) | (action))
+
+static const uint8_t transitions[NUM_STATES][NUM_CLASSES] PROGMEM = {
+	// ESC, '[', 'O', parameter, intermediate, final, control
+	[STATE_GROUND] = {
+		T(STATE_ESCAPE, DO_NOTHING), T(STATE_GROUND, DO_KEY),
+		T(STATE_GROUND, DO_KEY), T(STATE_GROUND, DO_KEY),
+		T(STATE_GROUND, DO_KEY), T(STATE_GROUND, DO_KEY),
+		T(STATE_GROUND, DO_KEY)
+	},
+	[STATE_ESCAPE] = {
+		T(STATE_GROUND, DO_ABANDON), T(STATE_CSI, DO_NOTHING),
+		T(STATE_SS3, DO_NOTHING), T(STATE_GROUND, DO_ABANDON),
+		T(STATE_GROUND, DO_ABANDON), T(STATE_GROUND, DO_ABANDON),
+		T(STATE_GROUND, DO_ABANDON)
+	},
+	[STATE_CSI] = {
+		T(STATE_GROUND, DO_ABANDON), T(STATE_GROUND, DO_DISPATCH),
+		T(STATE_GROUND, DO_DISPATCH), T(STATE_CSI, DO_COLLECT),
+		T(STATE_CSI, DO_COLLECT), T(STATE_GROUND, DO_DISPATCH),
+		T(STATE_GROUND, DO_ABANDON)
+	},
+	[STATE_SS3] = {
+		T(STATE_GROUND, DO_ABANDON), T(STATE_GROUND, DO_DISPATCH),
+		T(STATE_GROUND, DO_DISPATCH), T(STATE_GROUND, DO_ABANDON),
+		T(STATE_GROUND, DO_ABANDON), T(STATE_GROUND, DO_DISPATCH),
+		T(STATE_GROUND, DO_ABANDON)
+	}
+};
+
+// Longest run of parameter and intermediate characters we accept
+// (e.g. "1;5" for a modified cursor key)
+#define MAX_SEQUENCE_LENGTH 8
+
+// Queue of printable characters - a circular buffer. (Only used from
+// the main program.)
+#define ACTION_QUEUE_SIZE 16
+#define ACTION_QUEUE_MASK (ACTION_QUEUE_SIZE - 1)
+static uint8_t action_queue[ACTION_QUEUE_SIZE];
+static uint8_t queue_head;
+static uint8_t queue_tail;
+
+static uint8_t state;
+static uint8_t sequence_length;
+static uint16_t overruns;
+static uint16_t malformed;
+
+static uint8_t char_class(uint8_t c) {
+	if(c == ESCAPE_CHAR) {
+		return CLASS_ESCAPE;
+	} else if(c == '[') {
+		return CLASS_CSI;
+	} else if(c == 'O') {
+		return CLASS_SS3;
+	} else if(c >= '0' && c <= '?') {
+		return CLASS_PARAMETER;
+	} else if(c >= ' ' && c <= '/') {
+		return CLASS_INTERMEDIATE;
+	} else if(c >= '@' && c <= '~') {
+		return CLASS_FINAL;
+	}
+	return CLASS_CONTROL;
+}
+
+static void queue_action(uint8_t action) {
+	if((uint8_t)(queue_head - queue_tail) >= ACTION_QUEUE_SIZE) {
+		overruns++;
+		return;
+	}
+	action_queue[queue_head++ & ACTION_QUEUE_MASK] = action;
+}
+
+static void dispatch(uint8_t final) {
+	switch(final) {
+		case 'A': input_event(ACTION_ROTATE, INPUT_SERIAL); break;
+		case 'B': input_event(ACTION_DROP, INPUT_SERIAL); break;
+		case 'C': input_event(ACTION_RIGHT, INPUT_SERIAL); break;
+		case 'D': input_event(ACTION_LEFT, INPUT_SERIAL); break;
+		default: break;	// some other key (or a terminal report) - ignore
+	}
+}
+
+static void decode(uint8_t c) {
+	uint8_t transition = pgm_read_byte(&transitions[state][char_class(c)]);
+
+	state = transition >> 4;
+	switch(transition & 0x0F) {
+		case DO_KEY:
+			if(c >= ' ' && c <= '~') {
+				queue_action(c);
+			}
+			break;
+		case DO_COLLECT:
+			if(++sequence_length > MAX_SEQUENCE_LENGTH) {
+				malformed++;
+				state = STATE_GROUND;
+			}
+			break;
+		case DO_DISPATCH:
+			dispatch(c);
+			break;
+		case DO_ABANDON:
+			malformed++;
+			decode(c);	// state is now STATE_GROUND - won't abandon again
+			break;
+		default:
+			break;
+	}
+	if(state == STATE_GROUND) {
+		sequence_length = 0;
+	}
+}
+
+void serial_input_poll(void) {
+	int16_t c;
+	
+	while((c = serial_get_byte()) != -1) {
+		// Host control frames are picked out before decoding
+		if(!hostctl_receive(c)) {
+			decode(c);
+		}
+	}
+}
+
+int8_t serial_input_action(void) {
+	if(queue_head == queue_tail) {
+		return -1;
+	}
+	return action_queue[queue_tail++ & ACTION_QUEUE_MASK];
+}
+
+void serial_input_reset(void) {
+	clear_serial_input_buffer();
+	queue_tail = queue_head;
+	state = STATE_GROUND;
+	sequence_length = 0;
+}
+
+uint16_t serial_input_overruns(void) {
+	return overruns;
+}
+
+uint16_t serial_input_malformed(void) {
+	return malformed;
+}
@@ -0,0 +1,37 @@
+/*
+ * serialinput.h
+ *
+ * Decodes the characters typed at the serial terminal into game actions.
+ * serial_input_poll() should be called every time through the game loop -
+ * it reads every character waiting in the serial input buffer (so that
+ * buffer never overflows while we're busy). Cursor key escape sequences
+ * (ESC [ A to ESC [ D, or ESC O A to ESC O D in application cursor key
+ * mode, with or without parameters) become ACTION_ROTATE, ACTION_DROP,
+ * ACTION_RIGHT and ACTION_LEFT events in the input event queue (see
+ * input.h). Other printable characters are game commands - they are
+ * queued here as they are. Anything else is ignored. Host control frames
+ * (see hostctl.h) are passed to the host control module instead.
+ */
+
+#ifndef SERIALINPUT_H_
+#define SERIALINPUT_H_
+
+#include <stdint.h>
+
+// Read and decode all available serial input
+void serial_input_poll(void);
+
+// Return the next character from the queue, or -1 if it is empty
+int8_t serial_input_action(void);
+
+// Empty the queue and forget any partly received escape sequence
+void serial_input_reset(void);
+
+/* Statistics (since power on). Overruns are characters lost because the
+ * queue was full. Malformed sequences are escape sequences which were cut
+ * short by an unexpected character, or were too long.
+ */
+uint16_t serial_input_overruns(void);
+uint16_t serial_input_malformed(void);
+
+#endif /* SERIALINPUT_H_ */
@@ -8,15 +8,22 @@
  * any standard IO methods (e.g. printf). We use interrupt-based output
  * and a circular buffer to store output messages. (This allows us 
  * to print many characters at once to the buffer and have them 
- * output by the UART as speed permits.) If the buffer fills up, the
- * put method will either
- * (1) if interrupts are enabled, block until there is room in it, or
- * (2) if interrupts are disabled, will discard the character.
+ * output by the UART as speed permits.) If the buffer fills up, what
+ * happens depends on the output policy (see serial_set_output_policy()):
+ * (1) SERIAL_OUTPUT_BLOCK - if interrupts are enabled, output waits until
+ * there is room in the buffer, or
+ * (2) SERIAL_OUTPUT_DROP (or interrupts disabled) - output is discarded.
+ * Output is discarded a whole character (\r\n counts as one), message
+ * or reservation at a time, never part way through, and the loss is
+ * recorded for serial_output_dropped().
  * Input is blocking - requesting input from stdin will block
  * until a character is available. If interrupts are disabled when 
  * input is sought, then this will block forever.
  * The function input_available() can be used to test whether there is
  * input available to read from stdin.
+ * Both buffers have exactly one writer and one reader (the main program
+ * and an interrupt handler) so neither side needs to disable interrupts -
+ * see below.
  *
  */
 
@@ -24,49 +31,102 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
 
 /* System clock rate in Hz. (L at the end indicates this is a long constant) */
 #define SYSCLK 8000000L
 
 /* Global variables */
-/* Circular buffer to hold outgoing characters. The insert_pos variable
- * keeps track of the position (0 to OUTPUT_BUFFER_SIZE-1) that the next
- * outgoing character should be written to. bytes_in_buffer keeps
- * count of the number of characters currently stored in the buffer 
- * (ranging from 0 to OUTPUT_BUFFER_SIZE). This number of bytes immediately
- * prior to the current insert_pos are the bytes waiting to be output.
- * If the insert_pos reaches the end of the buffer it will wrap around
- * to the beginning (assuming those bytes have been output).
- * NOTE - OUTPUT_BUFFER_SIZE can not be larger than 255 without changing
- * the type of the variables below.
+/* Circular buffer to hold outgoing characters. out_head is the position
+ * the next outgoing character will be written to and is only changed by
+ * the writer (the main program). out_tail is the position of the next
+ * character to be sent and is only changed by the reader (the UART data
+ * register empty interrupt handler). The positions count up and wrap 
+ * around at 256 - the index into the buffer is the position masked by
+ * OUTPUT_BUFFER_MASK, and head - tail is the number of characters waiting.
+ * Each side writes its character before updating its own position (a
+ * single byte write, so atomic) which is why no interrupt disabling is
+ * needed. One slot is always left empty so that a full buffer can be told
+ * apart from an empty one.
+ * NOTE - OUTPUT_BUFFER_SIZE must be a power of two no larger than 256.
  */
-#define OUTPUT_BUFFER_SIZE 255
+#define OUTPUT_BUFFER_SIZE 256
+#define OUTPUT_BUFFER_MASK (OUTPUT_BUFFER_SIZE - 1)
 volatile char out_buffer[OUTPUT_BUFFER_SIZE];
-volatile uint8_t out_insert_pos;
-volatile uint8_t bytes_in_out_buffer;
+volatile uint8_t out_head;
+volatile uint8_t out_tail;
 
 /* Circular buffer to hold incoming characters. Works on same principle
- * as output buffer
+ * as output buffer (the writer is the receive complete interrupt handler).
+ * The size can be set with SERIAL_INPUT_BUFFER_SIZE (a power of two no
+ * larger than 256).
  */
-#define INPUT_BUFFER_SIZE 16
+#ifndef SERIAL_INPUT_BUFFER_SIZE
+#define SERIAL_INPUT_BUFFER_SIZE 64
+#endif
+#define INPUT_BUFFER_SIZE SERIAL_INPUT_BUFFER_SIZE
+#define INPUT_BUFFER_MASK (INPUT_BUFFER_SIZE - 1)
+#if (INPUT_BUFFER_SIZE & INPUT_BUFFER_MASK) != 0 || INPUT_BUFFER_SIZE > 256
+#error "SERIAL_INPUT_BUFFER_SIZE must be a power of two no larger than 256"
+#endif
 volatile char input_buffer[INPUT_BUFFER_SIZE];
-volatile uint8_t input_insert_pos;
-volatile uint8_t bytes_in_input_buffer;
-volatile uint8_t input_overrun;
+volatile uint8_t input_head;
+volatile uint8_t input_tail;
+
+/* Number of characters lost because the input buffer was full (or the
+ * UART's own receive buffer overflowed). Only written by the receive
+ * interrupt handler.
+ */
+static volatile uint16_t input_overruns;
+
+/* Software flow control. When enabled, the receive interrupt handler asks
+ * the other end to stop sending (XOFF) once the input buffer holds
+ * XOFF_LEVEL characters - the rest of the buffer is room for characters
+ * already on their way. Once the buffer has been read down to XON_LEVEL
+ * characters we ask for more (XON). flow_char is the flow control 
+ * character waiting to be sent (0 if none) - the data register empty 
+ * interrupt handler sends it ahead of any buffered output.
+ */
+#define XON 0x11
+#define XOFF 0x13
+#define XOFF_LEVEL (INPUT_BUFFER_SIZE - INPUT_BUFFER_SIZE / 4)
+#define XON_LEVEL (INPUT_BUFFER_SIZE / 4)
+static uint8_t flow_control;
+static volatile uint8_t input_stopped;
+static volatile char flow_char;
+
+/* Number of characters waiting in a buffer */
+#define BUFFER_COUNT(head, tail) ((uint8_t)((head) - (tail)))
+
+/* Current baud rate, and whether anything has been transmitted yet (so we
+ * know whether to wait for the transmit complete flag)
+ */
+static long current_baud;
+static volatile uint8_t transmitted;
 
 /* Variable to keep track of whether incoming characters are to be echoed
- * back or not.
+ * back or not. Characters are echoed as they are read (not from the 
+ * interrupt handler) so that the main program is the only writer to the
+ * output buffer.
  */
 static int8_t do_echo;
 
+/* What to do when the output buffer is full, and whether any output has
+ * been discarded since serial_output_dropped() was last called.
+ */
+static SerialOutputPolicy output_policy;
+static uint8_t output_dropped;
+
 /* Function prototypes 
  */
 void init_serial_stdio(long baudrate, int8_t echo);
 static int uart_put_char(char, FILE*);
 static int uart_get_char(FILE*);
+static int out_buffer_put(char);
 
 /* Setup a stream that uses the uart get and put functions. We will
  * make standard input and output use this stream below.
@@ -75,15 +135,16 @@ static FILE myStream = FDEV_SETUP_STREAM(uart_put_char, uart_get_char,
 		_FDEV_SETUP_RW);
 
 void init_serial_stdio(long baudrate, int8_t echo) {
-	uint16_t ubrr;
 	/*
 	 * Initialise our buffers
 	*/
-	out_insert_pos = 0;
-	bytes_in_out_buffer = 0;
-	input_insert_pos = 0;
-	bytes_in_input_buffer = 0;
-	input_overrun = 0;
+	out_head = 0;
+	out_tail = 0;
+	input_head = 0;
+	input_tail = 0;
+	input_overruns = 0;
+	input_stopped = 0;
+	flow_char = 0;
 	
 	/*
 	 * Record whether we're going to echo characters or not
@@ -91,12 +152,7 @@ void init_serial_stdio(long baudrate, int8_t echo) {
 	do_echo = echo;
 	
 	/* Configure the serial port baud rate */
-	/* (This differs from the datasheet formula so that we get 
-	 * rounding to the nearest integer while using integer division
-	 * (which truncates)).
-	*/
-	ubrr = ((SYSCLK / (8 * baudrate)) + 1)/2 - 1;
-	UBRR0 = ubrr;
+	serial_set_baud(baudrate);
 	
 	/*
 	 * Enable transmission and receiving via UART. We don't enable
@@ -120,97 +176,323 @@ void init_serial_stdio(long baudrate, int8_t echo) {
 	stdin = &myStream;
 }
 
+void serial_set_baud(long baudrate) {
+	uint16_t ubrr, ubrr_2x;
+	long error, error_2x;
+	
+	/* Let anything already buffered go at the old rate */
+	serial_flush();
+	
+	/* Work out the divider for normal (16 samples per bit) and double
+	 * speed (U2X - 8 samples per bit) modes and use whichever gives the
+	 * baud rate closest to the one asked for. (At 8MHz normal mode is
+	 * 7% out at 76800 baud but double speed mode is within 0.2%.)
+	 * (This differs from the datasheet formula so that we get 
+	 * rounding to the nearest integer while using integer division
+	 * (which truncates)).
+	 */
+	ubrr = ((SYSCLK / (8 * baudrate)) + 1)/2 - 1;
+	ubrr_2x = ((SYSCLK / (4 * baudrate)) + 1)/2 - 1;
+	error = labs(SYSCLK / (16 * (ubrr + 1L)) - baudrate);
+	error_2x = labs(SYSCLK / (8 * (ubrr_2x + 1L)) - baudrate);
+	if(error_2x < error) {
+		UCSR0A = (1 << U2X0);
+		UBRR0 = ubrr_2x;
+	} else {
+		UCSR0A = 0;
+		UBRR0 = ubrr;
+	}
+	current_baud = baudrate;
+}
+
+long serial_get_baud(void) {
+	return current_baud;
+}
+
+void serial_flush(void) {
+	if(!bit_is_set(SREG, SREG_I)) {
+		/* Buffer will never empty */
+		return;
+	}
+	while(out_head != out_tail) {
+		/* wait for the ISR to take everything */
+	}
+	if(transmitted) {
+		/* Wait for the last character to leave the shift register */
+		while(!(UCSR0A & (1 << TXC0))) {
+			/* do nothing */
+		}
+	}
+}
+
+void serial_set_flow_control(uint8_t enabled) {
+	flow_control = enabled;
+	if(!enabled && input_stopped) {
+		/* Don't leave the other end waiting */
+		input_stopped = 0;
+		flow_char = XON;
+		UCSR0B |= (1 << UDRIE0);
+	}
+}
+
+uint16_t serial_receive_overruns(void) {
+	uint16_t overruns;
+	
+	/* Updated by the receive interrupt handler - read it until we get the
+	 * same value twice, so we can't see half of an update */
+	do {
+		overruns = input_overruns;
+	} while(overruns != input_overruns);
+	return overruns;
+}
+
+/* Send XON if we stopped the input and it has now been read down to
+ * XON_LEVEL characters. (Called by the reader whenever it takes 
+ * characters. Once stopped the receive interrupt handler leaves
+ * input_stopped alone, so we don't need to disable interrupts.)
+ */
+static void check_input_resume(void) {
+	if(input_stopped && 
+			BUFFER_COUNT(input_head, input_tail) <= XON_LEVEL) {
+		input_stopped = 0;
+		flow_char = XON;
+		UCSR0B |= (1 << UDRIE0);
+	}
+}
+
 int8_t serial_input_available(void) {
-	return (bytes_in_input_buffer != 0);
+	return (input_head != input_tail);
+}
+
+/* Powers of ten used to convert numbers to decimal by repeated subtraction
+ * (much cheaper than 32 bit division on the AVR).
+ */
+static const uint32_t powers_of_ten[] PROGMEM = {
+	1000000000, 100000000, 10000000, 1000000, 100000, 
+	10000, 1000, 100, 10, 1
+};
+#define MAX_DECIMAL_DIGITS 10
+
+uint8_t serial_format_uint32(char* buffer, uint32_t value, uint8_t width) {
+	uint8_t length = 0;
+	uint8_t started = 0;
+	
+	for(uint8_t i = 0; i < MAX_DECIMAL_DIGITS; i++) {
+		uint32_t power = pgm_read_dword(&powers_of_ten[i]);
+		char digit = '0';
+		while(value >= power) {
+			value -= power;
+			digit++;
+		}
+		// Leading zeros become padding (but always keep the last digit)
+		if(started || digit != '0' || i == MAX_DECIMAL_DIGITS - 1) {
+			started = 1;
+			buffer[length++] = digit;
+		} else if(MAX_DECIMAL_DIGITS - i <= width) {
+			buffer[length++] = ' ';
+		}
+	}
+	return length;
+}
+
+uint8_t serial_put_uint32(uint32_t value, uint8_t width) {
+	char digits[MAX_DECIMAL_DIGITS];
+	uint8_t length = serial_format_uint32(digits, value, width);
+	
+	serial_write(digits, length);
+	return length;
+}
+
+uint8_t serial_output_space(void) {
+	return (OUTPUT_BUFFER_SIZE - 1) - BUFFER_COUNT(out_head, out_tail);
+}
+
+uint8_t serial_output_position(void) {
+	return out_head;
+}
+
+uint8_t serial_output_sent(uint8_t position) {
+	uint8_t head = out_head;
+	
+	// Sent if every byte still waiting was written after position
+	return (uint8_t)(head - position) >= BUFFER_COUNT(head, out_tail);
+}
+
+void serial_set_output_policy(SerialOutputPolicy policy) {
+	output_policy = policy;
+}
+
+uint8_t serial_output_dropped(void) {
+	uint8_t dropped = output_dropped;
+	output_dropped = 0;
+	return dropped;
+}
+
+/* Wait (if the policy allows) until length bytes of output buffer space
+ * are free. Returns 0, recording the loss, if the output can't be sent.
+ */
+static uint8_t wait_for_space(uint8_t length) {
+	while(serial_output_space() < length) {
+		if(output_policy == SERIAL_OUTPUT_DROP || 
+				!bit_is_set(SREG, SREG_I)) {
+			output_dropped = 1;
+			return 0;
+		}
+		/* else wait - out_tail will be moved on by the ISR */
+	}
+	return 1;
 }
 
 void clear_serial_input_buffer(void) {
-	/* Just adjust our buffer data so it looks empty */
-	input_insert_pos = 0;
-	bytes_in_input_buffer = 0;
+	/* Just adjust our buffer data so it looks empty (we're the reader so
+	 * we can move the tail up to the head) */
+	input_tail = input_head;
+	check_input_resume();
 }
 
-static int uart_put_char(char c, FILE* stream) {
-	uint8_t interrupts_enabled;
+int16_t serial_get_byte(void) {
+	uint8_t tail = input_tail;
+	uint8_t c;
 	
-	/* Add the character to the buffer for transmission (if there 
-	 * is space to do so). If not we wait until the buffer has space.
-	 * If the character is \n, we output \r (carriage return)
+	if(input_head == tail) {
+		return -1;
+	}
+	c = input_buffer[tail & INPUT_BUFFER_MASK];
+	input_tail = tail + 1;
+	check_input_resume();
+	return c;
+}
+
+/* Copy length bytes (from RAM, or from flash if in_flash is non-zero) into
+ * the output buffer. Each run of bytes which fits is published with a
+ * single update of out_head. When blocking, waits for space as 
+ * out_buffer_put() does. Otherwise the bytes are only written if they 
+ * all fit.
+ */
+static uint8_t write_bytes(const char* data, uint8_t length, uint8_t in_flash) {
+	uint8_t written = 0;
+	
+	if(output_policy == SERIAL_OUTPUT_DROP && !wait_for_space(length)) {
+		return 0;
+	}
+	while(written < length) {
+		uint8_t head = out_head;
+		uint8_t space = (OUTPUT_BUFFER_SIZE - 1) - BUFFER_COUNT(head, out_tail);
+		
+		if(space == 0) {
+			if(!bit_is_set(SREG, SREG_I)) {
+				/* Buffer will never empty - discard the rest */
+				output_dropped = 1;
+				break;
+			}
+			continue;
+		}
+		if(space > length - written) {
+			space = length - written;
+		}
+		while(space--) {
+			out_buffer[head++ & OUTPUT_BUFFER_MASK] = in_flash ? 
+					pgm_read_byte(data++) : *data++;
+			written++;
+		}
+		out_head = head;
+		UCSR0B |= (1 << UDRIE0);
+	}
+	return written;
+}
+
+uint8_t serial_write(const char* data, uint8_t length) {
+	return write_bytes(data, length, 0);
+}
+
+uint8_t serial_write_P(const char* str) {
+	return write_bytes(str, strlen_P(str), 1);
+}
+
+/* Position at which the next reserved byte will be written */
+static uint8_t reserve_pos;
+
+uint8_t serial_reserve(uint8_t length) {
+	if(!wait_for_space(length)) {
+		return 0;
+	}
+	reserve_pos = out_head;
+	return 1;
+}
+
+void serial_emit(char c) {
+	out_buffer[reserve_pos++ & OUTPUT_BUFFER_MASK] = c;
+}
+
+void serial_commit(void) {
+	out_head = reserve_pos;
+	UCSR0B |= (1 << UDRIE0);
+}
+
+static int uart_put_char(char c, FILE* stream) {
+	/* If the character is \n, we output \r (carriage return)
 	 * also.
 	*/
 	if(c == '\n') {
-		uart_put_char('\r', stream);
+		/* Both or neither */
+		if(!wait_for_space(2)) {
+			return 1;
+		}
+		out_buffer_put('\r');
 	}
+	return out_buffer_put(c);
+}
+
+static int out_buffer_put(char c) {
+	uint8_t head = out_head;
 	
-	/* If the buffer is full and interrupts are disabled then we
-	 * abort - we don't output the character since the buffer will
-	 * never be emptied if interrupts are disabled. If the buffer is full
-	 * and interrupts are enabled then we loop until the buffer has 
-	 * enough space. The bytes_in_buffer variable will get modified by the
-	 * ISR which extracts bytes from the buffer.
+	/* Add the character to the buffer for transmission (if there 
+	 * is space to do so). If not we either wait until the buffer has
+	 * space or discard the character - see wait_for_space().
 	*/
-	interrupts_enabled = bit_is_set(SREG, SREG_I);
-	while(bytes_in_out_buffer >= OUTPUT_BUFFER_SIZE) {
-		if(!interrupts_enabled) {
-			return 1;
-		}		
-		/* else do nothing */
+	if(!wait_for_space(1)) {
+		return 1;
 	}
 	
-	/* Add the character to the buffer for transmission if there
-	 * is space to do so. We advance the insert_pos to the next
-	 * character position. If this is beyond the end of the buffer
-	 * we wrap around back to the beginning of the buffer 
-	 * NOTE: we disable interrupts before modifying the buffer. This
-	 * prevents the ISR from modifying the buffer at the same time.
-	 * We reenable them if they were enabled when we entered the
-	 * function.
+	/* Store the character then advance the head - the ISR won't look
+	 * at the character until the head has moved past it.
 	*/	
-	cli();
-	out_buffer[out_insert_pos++] = c;
-	bytes_in_out_buffer++;
-	if(out_insert_pos == OUTPUT_BUFFER_SIZE) {
-		/* Wrap around buffer pointer if necessary */
-		out_insert_pos = 0;
-	}
-	/* Reenable interrupts (UDR Empty interrupt may have been
-	 * disabled) */
+	out_buffer[head & OUTPUT_BUFFER_MASK] = c;
+	out_head = head + 1;
+	/* Make sure the UDR Empty interrupt is enabled (the ISR disables it 
+	 * when the buffer is empty) */
 	UCSR0B |= (1 << UDRIE0);
-	if(interrupts_enabled) {
-		sei();
-	}
 	return 0;
 }
 
 int uart_get_char(FILE* stream) {
+	uint8_t tail = input_tail;
+	char c;
+	
 	/* Wait until we've received a character */
-	while(bytes_in_input_buffer == 0) {
+	while(input_head == tail) {
 		/* do nothing */
 	}
 	
-	/*
-	 * Turn interrupts off and remove a character from the input
-	 * buffer. We reenable interrupts if they were on.
-	 * The pending character is the one which is byte_in_input_buffer
-	 * characters before the insert position (taking into account
-	 * that we may need to wrap around).
+	/* Take the character then advance the tail - the ISR won't reuse
+	 * the slot until the tail has moved past it.
 	 */
-	uint8_t interrupts_enabled = bit_is_set(SREG, SREG_I);
-	cli();
-	char c;
-	if(input_insert_pos - bytes_in_input_buffer < 0) {
-		/* Need to wrap around */
-		c = input_buffer[input_insert_pos - bytes_in_input_buffer
-				+ INPUT_BUFFER_SIZE];
-	} else {
-		c = input_buffer[input_insert_pos - bytes_in_input_buffer];
+	c = input_buffer[tail & INPUT_BUFFER_MASK];
+	input_tail = tail + 1;
+	check_input_resume();
+	
+	/* If the character is a carriage return, turn it into a linefeed */
+	if(c == '\r') {
+		c = '\n';
 	}
 	
-	/* Decrement our count of bytes in the input buffer */
-	bytes_in_input_buffer--;
-	if(interrupts_enabled) {
-		sei();
-	}	
+	if(do_echo) {
+		/* If echoing is enabled, echo the character back to the UART.
+		 * (Carriage returns have been turned into linefeeds and are
+		 * echoed as both.)
+		 */
+		uart_put_char(c, 0);
+	}
 	return c;
 }
 
@@ -220,29 +502,25 @@ int uart_get_char(FILE* stream) {
  */
 ISR(USART0_UDRE_vect) 
 {
-	/* Check if we have data in our buffer */
-	if(bytes_in_out_buffer > 0) {
-		/* Yes we do - remove the pending byte and output it
-		 * via the UART. The pending byte (character) is the
-		 * one which is "bytes_in_buffer" characters before the 
-		 * insert_pos (taking into account that we may 
-		 * need to wrap around to the end of the buffer).
-		 */
-		char c;
-		if(out_insert_pos - bytes_in_out_buffer < 0) {
-			/* Need to wrap around */
-			c = out_buffer[out_insert_pos - bytes_in_out_buffer
-				+ OUTPUT_BUFFER_SIZE];
-		} else {
-			c = out_buffer[out_insert_pos - bytes_in_out_buffer];
-		}
-		/* Decrement our count of the number of bytes in the 
-		 * buffer 
+	uint8_t tail = out_tail;
+	
+	/* Flow control characters go first */
+	if(flow_char) {
+		UDR0 = flow_char;
+		flow_char = 0;
+		UCSR0A |= (1 << TXC0);
+		transmitted = 1;
+	} else if(out_head != tail) {
+		/* Check if we have data in our buffer */
+		/* Yes we do - output the oldest byte via the UART and advance
+		 * the tail
 		 */
-		bytes_in_out_buffer--;
-		
-		/* Output the character via the UART */
-		UDR0 = c;
+		UDR0 = out_buffer[tail & OUTPUT_BUFFER_MASK];
+		out_tail = tail + 1;
+		/* Clear the transmit complete flag (by writing a 1 to it) so that
+		 * it shows when this character has gone - see serial_flush() */
+		UCSR0A |= (1 << TXC0);
+		transmitted = 1;
 	} else {
 		/* No data in the buffer. We disable the UART Data
 		 * Register Empty interrupt because otherwise it 
@@ -262,43 +540,45 @@ ISR(USART0_UDRE_vect)
 
 ISR(USART0_RX_vect) 
 {
-	/* Read the character - we ignore the possibility of overrun. */
+	/* Read the character */
+	uint8_t head = input_head;
+	uint8_t status = UCSR0A;
+	uint8_t count;
 	char c;
 	c = UDR0;
-		
-	if(do_echo && bytes_in_out_buffer < OUTPUT_BUFFER_SIZE) {
-		/* If echoing is enabled and there is output buffer
-		 * space, echo the received character back to the UART.
-		 * (If there is no output buffer space, characters
-		 * will be lost.)
-		 */
-		uart_put_char(c, 0);
+	
+	if(status & (1 << DOR0)) {
+		/* We were too slow - at least one character was lost before
+		 * this one */
+		input_overruns++;
+	}
+	if(status & (1 << FE0)) {
+		/* Framing error - most likely the other end is using a different
+		 * baud rate. Throw the character away. */
+		return;
 	}
 	
 	/* 
-	 * Check if we have space in our buffer. If not, set the overrun
-	 * flag and throw away the character. (We never clear the 
-	 * overrun flag - it's up to the programmer to check/clear
-	 * this flag if desired.)
+	 * Check if we have space in our buffer. If not, count the overrun
+	 * and throw away the character. (See serial_receive_overruns().)
 	 */
-	if(bytes_in_input_buffer >= INPUT_BUFFER_SIZE) {
-		input_overrun = 1;
+	count = BUFFER_COUNT(head, input_tail);
+	if(count >= INPUT_BUFFER_SIZE - 1) {
+		input_overruns++;
 	} else {
-		/* If the character is a carriage return, turn it into a
-		 * linefeed 
-		*/
-		if (c == '\r') {
-			c = '\n';
-		}
-		
 		/* 
-		 * There is room in the input buffer 
+		 * There is room in the input buffer. (Characters are stored as
+		 * received - carriage returns are turned into linefeeds when
+		 * they're read through stdio.)
 		 */
-		input_buffer[input_insert_pos++] = c;
-		bytes_in_input_buffer++;
-		if(input_insert_pos == INPUT_BUFFER_SIZE) {
-			/* Wrap around buffer pointer if necessary */
-			input_insert_pos = 0;
-		}
+		input_buffer[head & INPUT_BUFFER_MASK] = c;
+		input_head = head + 1;
+		count++;
+	}
+	if(flow_control && !input_stopped && count >= XOFF_LEVEL) {
+		/* Getting full - ask the other end to stop */
+		input_stopped = 1;
+		flow_char = XOFF;
+		UCSR0B |= (1 << UDRIE0);
 	}
 }
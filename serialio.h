@@ -25,11 +25,105 @@
  */
 void init_serial_stdio(long baudrate, int8_t echo);
 
+/* Change the baud rate (after waiting for any buffered output to be sent).
+ * Double speed mode is used if that gives a more accurate rate - at 8MHz
+ * 19200, 38400, 76800 and 250000 baud can all be used.
+ */
+void serial_set_baud(long baudrate);
+long serial_get_baud(void);
+
+/* Wait until all buffered output has been sent (returns immediately if
+ * interrupts are disabled).
+ */
+void serial_flush(void);
+
 /* Test if input is available from the serial port. Return 0 if not,
  * non-zero otherwise.
  */
 int8_t serial_input_available(void);
 
+/* Turn XON/XOFF flow control of serial input on or off (default off).
+ * When on, XOFF is sent when the input buffer is three quarters full and
+ * XON once it has been read down to a quarter full. The flow control 
+ * characters are sent straight away, so they can appear anywhere in the
+ * output - even part way through an escape sequence, telemetry message or
+ * host control reply. So it must be off while binary data is being sent.
+ * The input buffer size can be set with SERIAL_INPUT_BUFFER_SIZE.
+ */
+void serial_set_flow_control(uint8_t enabled);
+
+/* Return the number of input characters lost (since init_serial_stdio())
+ * because the input buffer was full or the UART receiver overran.
+ */
+uint16_t serial_receive_overruns(void);
+
+/* Return the next input byte exactly as received (no \r to \n
+ * translation or echo), or -1 if there is none. Doesn't wait.
+ */
+int16_t serial_get_byte(void);
+
+/* Output value as a decimal number, right aligned (padded with spaces)
+ * in a field of the given width (0 for no padding, at most 10). This
+ * is much smaller and faster than printf's %d/%ld and handles the full
+ * range of uint32_t. Returns the number of characters output.
+ */
+uint8_t serial_put_uint32(uint32_t value, uint8_t width);
+
+/* As above but the characters (at most 10, no terminating null) are
+ * stored in buffer rather than output. Returns the number stored.
+ */
+uint8_t serial_format_uint32(char* buffer, uint32_t value, uint8_t width);
+
+/* What to do with output when the output buffer is full. 
+ * SERIAL_OUTPUT_BLOCK (the default) waits for space - unless interrupts
+ * are disabled, when output is discarded. SERIAL_OUTPUT_DROP never 
+ * waits: output which doesn't fit is discarded. Output is only ever 
+ * discarded whole - a character, a serial_write() or a reservation.
+ * serial_output_dropped() returns non-zero if anything has been discarded
+ * since it was last called (and clears the record of it).
+ */
+typedef enum {
+	SERIAL_OUTPUT_BLOCK,
+	SERIAL_OUTPUT_DROP
+} SerialOutputPolicy;
+
+void serial_set_output_policy(SerialOutputPolicy policy);
+uint8_t serial_output_dropped(void);
+
+/* Output length bytes from data (or the null terminated string str in
+ * program memory) exactly as given - no \n to \r\n translation. These
+ * are much cheaper than stdio for more than a few bytes. If the output 
+ * buffer fills they wait for space when blocking (with interrupts 
+ * disabled the rest is discarded). When dropping, nothing is output 
+ * unless it all fits. Return the number of bytes output.
+ */
+uint8_t serial_write(const char* data, uint8_t length);
+uint8_t serial_write_P(const char* str);
+
+/* Format output directly into the output buffer. serial_reserve() returns
+ * non-zero if length bytes of space are available (waiting for them when
+ * blocking) and 0, reserving nothing, if not. Up to length bytes can then be added with 
+ * serial_emit() - these are not sent until serial_commit() is called. 
+ * Nothing else may be output between serial_reserve() and serial_commit().
+ */
+uint8_t serial_reserve(uint8_t length);
+void serial_emit(char c);
+void serial_commit(void);
+
+/* Return the number of bytes which can be written to the output buffer
+ * without waiting.
+ */
+uint8_t serial_output_space(void);
+
+/* Track output through the buffer. serial_output_position() returns the
+ * position just after the last byte written so far. serial_output_sent()
+ * returns non-zero once every byte before that position has been handed
+ * to the UART. (It must be checked before another full buffer's worth of
+ * output has been written.)
+ */
+uint8_t serial_output_position(void);
+uint8_t serial_output_sent(uint8_t position);
+
 /* Discard any input waiting to be read from the serial port. (Characters may
  * have been typed when we didn't want them - clear them.
  */
@@ -0,0 +1,78 @@
+/*
+ * seven_seg.c
+ *
+ * Author: Benedict Gattas
+ *
+ * Keeps the seven segment display switching between its two digits fast
+ * enough to display a two-digit number (how many rows have been
+ * completed). This used to have timer 2 to itself - it is now a soft
+ * timer run by the timer 0 interrupt handler.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "seven_seg.h"
+#include "timer0.h"
+
+/* How often (ms) we switch digits - as timer 2 did (clock / 64, counting
+ * to 124, is 1ms)
+ */
+#define SEVEN_SEG_PERIOD 1
+
+/* The (mod 100) count of how many rows have been completed
+ */
+
+static volatile uint8_t number_of_rows;
+static volatile uint8_t number_to_display;
+
+/* Seven segment display digit being displayed.
+** 0 = right digit; 1 = left digit.
+*/
+static uint8_t seven_seg_cc = 0;
+
+static const uint8_t seven_seg_data[10] = {63,6,91,79,102,109,125,7,127,111};
+
+/* Called every SEVEN_SEG_PERIOD ms from the timer 0 interrupt handler
+ */
+static void display_next_digit(void) {
+	/* Change which digit will be displayed. If last time was
+	** left, now display right. If last time was right, now 
+	** display left.
+	*/
+	seven_seg_cc = 1 ^ seven_seg_cc;
+	
+	/* Display a digit */
+	if(seven_seg_cc == 0) {
+		/* Display rightmost digit - units */
+		PORTC = seven_seg_data[number_to_display%10];
+	} else {
+		/* Display leftmost digit - tens */
+		PORTC = seven_seg_data[number_to_display/10];
+	}
+	/* Output the digit selection (CC) bit */
+	PORTA = seven_seg_cc;	
+}
+
+void init_seven_seg(void) {
+	//set the initial number of completed rows to 0
+	set_row_count(0);
+	/* Make all bits of port C and the least significant
+	** bit of port A be output bits.
+	*/
+	DDRC = 0xFF;
+	DDRA |= 0x01;
+	
+	add_soft_timer(display_next_digit, SEVEN_SEG_PERIOD);
+}
+
+void set_row_count(uint8_t row_count) {
+	//display within 100
+	number_of_rows = row_count;
+	number_to_display = (number_of_rows % 100);
+}
+
+uint8_t get_row_count(void) {
+	//return the current row count	
+	return(number_of_rows);	
+}
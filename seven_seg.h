@@ -0,0 +1,26 @@
+/*
+ * seven_seg.h
+ *
+ * Author: Benedict Gattas
+ *
+ * The two digit seven segment display shows how many rows have been
+ * completed (mod 100). The digits are displayed alternately, switching
+ * every millisecond, by a timer 0 soft timer (see timer0.h) - so the display
+ * keeps going even when the game is paused.
+ */
+
+#ifndef SEVEN_SEG_H_
+#define SEVEN_SEG_H_
+
+#include <stdint.h>
+
+/* Set up the seven segment display (port C and pin A0) showing 0 and
+ * start switching between the digits. init_timer0() must be called too.
+ */
+void init_seven_seg(void);
+
+void set_row_count(uint8_t row_count);
+
+uint8_t get_row_count(void);
+
+#endif
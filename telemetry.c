@@ -0,0 +1,295 @@
+/*
+ * telemetry.c
+ *
+ * Binary telemetry stream - see telemetry.h for the message formats.
+ *
+ * We keep a copy of the board colours as last sent (as colour indices,
+ * two cells per byte) so that only the cells which have changed need to
+ * be sent. Every TELEMETRY_KEYFRAME_INTERVAL updates we send the whole
+ * board again (colours and a bitboard) so a viewer which has missed
+ * messages, or which starts part way through a game, catches up.
+ * In placement mode only the LOCK/SPAWN records and keyframes are sent.
+ */
+
+#include "telemetry.h"
+#include "serialio.h"
+#include "terminalio.h"
+#include "score.h"
+#include "seven_seg.h"
+
+#define TELEMETRY_KEYFRAME_INTERVAL 32
+#define SHADOW_UNKNOWN 0x0F
+
+static TelemetryMode mode;
+static uint8_t sequence;
+static uint8_t shadow[TELEMETRY_BOARD_CELLS / 2];
+static uint8_t updates_until_keyframe;
+static uint8_t bitboard_due;
+static uint32_t score_sent;
+static uint8_t rows_sent;
+static uint8_t next_sent;		// (blocknum << 2) | rotation
+static uint8_t state_sent;		// non-zero once score/next have been sent
+static uint16_t lock_count;
+static uint8_t keyframe_due;
+
+// Message being built - header, payload and room for the CRC
+static uint8_t message[TELEMETRY_HEADER_SIZE + TELEMETRY_MAX_PAYLOAD + 1];
+#define PAYLOAD (message + TELEMETRY_HEADER_SIZE)
+
+static void invalidate_state(void) {
+	for(uint8_t i = 0; i < sizeof(shadow); i++) {
+		shadow[i] = (SHADOW_UNKNOWN << 4) | SHADOW_UNKNOWN;
+	}
+	state_sent = 0;
+	bitboard_due = 1;
+	keyframe_due = 1;
+	updates_until_keyframe = TELEMETRY_KEYFRAME_INTERVAL;
+}
+
+void telemetry_set_mode(TelemetryMode new_mode) {
+	mode = new_mode;
+	invalidate_state();
+	// The binary stream replaces the ANSI board, score and preview output
+	terminal_set_output_enabled(mode == TELEMETRY_OFF);
+}
+
+TelemetryMode telemetry_get_mode(void) {
+	return mode;
+}
+
+/*
+ * Frame and send the message in the message buffer (payload_length bytes
+ * of payload). The message is sent whole or not at all - if it doesn't fit
+ * in the serial output buffer we return 0 without sending anything.
+ */
+static uint8_t send_message(uint8_t type, uint8_t payload_length) {
+	uint8_t length = TELEMETRY_HEADER_SIZE + payload_length;
+	uint8_t crc = 0;
+
+	if(serial_output_space() < length + 1) {
+		return 0;
+	}
+	message[0] = TELEMETRY_SYNC;
+	message[1] = type;
+	message[2] = sequence++;
+	message[3] = payload_length;
+	for(uint8_t i = 1; i < length; i++) {
+		crc = telemetry_crc8(crc, message[i]);
+	}
+	message[length] = crc;
+	serial_write((const char*)message, length + 1);
+	return 1;
+}
+
+static uint8_t colour_index(PixelColour colour) {
+	switch(colour) {
+		case COLOUR_BLACK: return TELEMETRY_COLOUR_BLACK;
+		case COLOUR_RED: return TELEMETRY_COLOUR_RED;
+		case COLOUR_GREEN: return TELEMETRY_COLOUR_GREEN;
+		case COLOUR_YELLOW: return TELEMETRY_COLOUR_YELLOW;
+		case COLOUR_ORANGE: return TELEMETRY_COLOUR_ORANGE;
+		case COLOUR_LIGHT_ORANGE: return TELEMETRY_COLOUR_LIGHT_ORANGE;
+		case COLOUR_LIGHT_YELLOW: return TELEMETRY_COLOUR_LIGHT_YELLOW;
+		case COLOUR_LIGHT_GREEN: return TELEMETRY_COLOUR_LIGHT_GREEN;
+		case 0x11: return TELEMETRY_COLOUR_GHOST;
+		default: return TELEMETRY_COLOUR_OTHER;
+	}
+}
+
+static uint8_t cell_colour(MatrixColumn* board_display, uint8_t cell) {
+	return colour_index(board_display[cell / TELEMETRY_BOARD_WIDTH]
+			[cell % TELEMETRY_BOARD_WIDTH]);
+}
+
+static uint8_t shadow_colour(uint8_t cell) {
+	uint8_t pair = shadow[cell >> 1];
+	return (cell & 1) ? (pair >> 4) : (pair & 0x0F);
+}
+
+static void set_shadow_colour(uint8_t cell, uint8_t colour) {
+	if(cell & 1) {
+		shadow[cell >> 1] = (shadow[cell >> 1] & 0x0F) | (colour << 4);
+	} else {
+		shadow[cell >> 1] = (shadow[cell >> 1] & 0xF0) | colour;
+	}
+}
+
+/*
+ * Send COLOURS messages for the cells which differ from our copy. Returns
+ * 1 if we ran out of serial buffer space before everything was sent.
+ */
+static uint8_t send_colour_changes(MatrixColumn* board_display) {
+	uint8_t cell = 0;
+
+	while(1) {
+		uint8_t length = 0;
+		uint8_t next_cell;
+
+		// Find the first changed cell
+		while(cell < TELEMETRY_BOARD_CELLS &&
+				shadow_colour(cell) == cell_colour(board_display, cell)) {
+			cell++;
+		}
+		if(cell >= TELEMETRY_BOARD_CELLS) {
+			return 0;
+		}
+		PAYLOAD[length++] = cell;
+		next_cell = cell;
+		// Add runs until we run out of changes or payload space
+		while(length + 2 <= TELEMETRY_MAX_PAYLOAD) {
+			uint8_t run_start = next_cell;
+			uint8_t colour, run_length;
+
+			while(run_start < TELEMETRY_BOARD_CELLS &&
+					shadow_colour(run_start) == cell_colour(board_display, run_start)) {
+				run_start++;
+			}
+			if(run_start >= TELEMETRY_BOARD_CELLS) {
+				break;
+			}
+			colour = cell_colour(board_display, run_start);
+			run_length = 1;
+			while(run_start + run_length < TELEMETRY_BOARD_CELLS &&
+					run_length < TELEMETRY_MAX_RUN &&
+					cell_colour(board_display, run_start + run_length) == colour) {
+				run_length++;
+			}
+			PAYLOAD[length++] = run_start - next_cell;
+			PAYLOAD[length++] = ((run_length - 1) << 4) | colour;
+			next_cell = run_start + run_length;
+		}
+		if(!send_message(TELEMETRY_MSG_COLOURS, length)) {
+			return 1;
+		}
+		// Sent - record the new colours of the cells it covered
+		for(uint8_t i = 1; i < length; i += 2) {
+			cell += PAYLOAD[i];
+			for(uint8_t run = 0; run <= (PAYLOAD[i+1] >> 4); run++) {
+				set_shadow_colour(cell++, PAYLOAD[i+1] & 0x0F);
+			}
+		}
+	}
+}
+
+static uint8_t send_bitboard(MatrixColumn* board_display) {
+	for(uint8_t row = 0; row < TELEMETRY_BOARD_ROWS; row++) {
+		uint8_t bits = 0;
+		for(uint8_t col = 0; col < TELEMETRY_BOARD_WIDTH; col++) {
+			// board_display element 0 is the leftmost column, which is
+			// board column BOARD_WIDTH-1
+			PixelColour colour = board_display[row][col];
+			if(colour != COLOUR_BLACK && colour != 0x11) {
+				bits |= 1 << (TELEMETRY_BOARD_WIDTH - 1 - col);
+			}
+		}
+		PAYLOAD[row] = bits;
+	}
+	return send_message(TELEMETRY_MSG_BITBOARD, TELEMETRY_BOARD_ROWS);
+}
+
+static uint8_t send_keyframe(rowtype* board) {
+	uint32_t score = get_score();
+	
+	PAYLOAD[0] = lock_count;
+	PAYLOAD[1] = lock_count >> 8;
+	for(uint8_t row = 0; row < TELEMETRY_BOARD_ROWS; row++) {
+		PAYLOAD[2 + row] = board[row];
+	}
+	PAYLOAD[18] = score;
+	PAYLOAD[19] = score >> 8;
+	PAYLOAD[20] = score >> 16;
+	PAYLOAD[21] = score >> 24;
+	return send_message(TELEMETRY_MSG_KEYFRAME, 22);
+}
+
+// Send a two byte record - whole or not at all
+static void send_record(uint8_t first, uint8_t second) {
+	char record[2];
+	
+	if(serial_output_space() < 2) {
+		// Viewer will miss this - have it resynchronise instead
+		keyframe_due = 1;
+		return;
+	}
+	record[0] = first;
+	record[1] = second;
+	serial_write(record, 2);
+}
+
+void telemetry_lock(FallingBlock block) {
+	if(mode != TELEMETRY_PLACEMENTS) {
+		return;
+	}
+	send_record(TELEMETRY_RECORD_LOCK | (block.blocknum << 2) | block.rotation,
+			(block.row << 4) | block.column);
+	lock_count++;
+	if(lock_count % TELEMETRY_KEYFRAME_LOCKS == 0) {
+		keyframe_due = 1;
+	}
+}
+
+void telemetry_spawn(FallingBlock block, FallingBlock next) {
+	if(mode != TELEMETRY_PLACEMENTS) {
+		return;
+	}
+	send_record(TELEMETRY_RECORD_SPAWN | (block.blocknum << 2) | block.rotation,
+			(next.blocknum << 5) | (next.rotation << 3) | block.column);
+}
+
+void telemetry_board_replaced(void) {
+	keyframe_due = 1;
+}
+
+uint8_t telemetry_update(MatrixColumn* board_display, rowtype* board,
+		FallingBlock next) {
+	uint8_t more;
+	uint32_t score = get_score();
+	uint8_t rows = get_row_count();
+	uint8_t next_block = (next.blocknum << 2) | next.rotation;
+
+	if(mode == TELEMETRY_OFF) {
+		return 0;
+	}
+	if(mode == TELEMETRY_PLACEMENTS) {
+		// The fixed blocks only change when a block is locked (which sends
+		// its own record) so board is always in step with the records sent
+		if(keyframe_due) {
+			keyframe_due = !send_keyframe(board);
+		}
+		return keyframe_due;
+	}
+	if(--updates_until_keyframe == 0) {
+		invalidate_state();
+	}
+	more = send_colour_changes(board_display);
+	if(bitboard_due && !more) {
+		bitboard_due = !send_bitboard(board_display);
+		more |= bitboard_due;
+	}
+	if(!state_sent || score != score_sent || rows != rows_sent) {
+		PAYLOAD[0] = score;
+		PAYLOAD[1] = score >> 8;
+		PAYLOAD[2] = score >> 16;
+		PAYLOAD[3] = score >> 24;
+		PAYLOAD[4] = rows;
+		if(send_message(TELEMETRY_MSG_SCORE, 5)) {
+			score_sent = score;
+			rows_sent = rows;
+		} else {
+			more = 1;
+		}
+	}
+	if(!state_sent || next_block != next_sent) {
+		PAYLOAD[0] = next.blocknum;
+		PAYLOAD[1] = next.rotation;
+		if(send_message(TELEMETRY_MSG_NEXT, 2)) {
+			next_sent = next_block;
+		} else {
+			more = 1;
+		}
+	}
+	if(!more) {
+		state_sent = 1;
+	}
+	return more;
+}
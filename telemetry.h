@@ -0,0 +1,134 @@
+/*
+ * telemetry.h
+ *
+ * Compact binary stream of the game state, for watching a game remotely
+ * over the serial line (see host/tetris_view.c for a viewer). This file is
+ * shared with the host programs so must only depend on the standard
+ * integer types and the block/colour definitions.
+ *
+ * Every message is framed as follows:
+ *	TELEMETRY_SYNC  type  sequence  length  payload[length]  crc
+ * The sequence number increases by one with every message sent (wrapping
+ * at 256) so that lost messages can be detected. The CRC is a CRC-8
+ * (polynomial 0x07, initial value 0) over type, sequence, length and the
+ * payload. TELEMETRY_SYNC is never sent as part of the ANSI terminal
+ * output (which is 7 bit) so a receiver can find the start of a message by
+ * looking for it and checking the CRC.
+ *
+ * In placement mode (for spectators) the board is not sent at all. Instead
+ * each locked block and each new block is described by a two byte record,
+ * and the viewer repeats the game's line clears itself (see
+ * host/tetris_spectate.c):
+ *	LOCK	100bbbrr  rrrrcccc	block b with rotation r locked with its top
+ *								row at board row rrrr and column cccc
+ *	SPAWN	101bbbrr  nnnRRccc	block b with rotation r added to the top of
+ *								the board at column ccc; next block is n
+ *								with rotation RR
+ * These first bytes (0x80 to 0xBF) never clash with TELEMETRY_SYNC or with
+ * terminal output. A KEYFRAME message is sent every
+ * TELEMETRY_KEYFRAME_LOCKS locked blocks (and whenever the board changes
+ * in some other way, or a record couldn't be sent) so that the viewer can
+ * check its board and resynchronise.
+ */
+
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+#include <stdint.h>
+#include "ledmatrix.h"
+#include "blocks.h"
+
+#define TELEMETRY_SYNC 0xF5
+#define TELEMETRY_HEADER_SIZE 4		// sync, type, sequence, length
+#define TELEMETRY_MAX_PAYLOAD 48
+
+/*
+ * Message types.
+ * BITBOARD - 16 bytes, one per board row (row 0 first). Bit n is set if
+ *		board column n (column 0 on the right) is occupied. The falling block
+ *		is included, the ghost block is not.
+ * COLOURS - colour changes: the index (0 to 127) of the first board cell
+ *		covered, then pairs of bytes (skip, run). skip is the number of cells
+ *		left unchanged and run is ((run length - 1) << 4) | colour index -
+ *		that many cells take the given colour. Cells are numbered along each
+ *		row from the left, starting at the top row.
+ * SCORE - score (4 bytes, least significant first) then rows cleared.
+ * NEXT - block number and rotation of the next block.
+ * KEYFRAME - number of blocks locked so far (2 bytes, least significant
+ *		first), the 16 rows of the board without the falling block (as for
+ *		BITBOARD) then the score (4 bytes, least significant first).
+ */
+#define TELEMETRY_MSG_BITBOARD 0x01
+#define TELEMETRY_MSG_COLOURS 0x02
+#define TELEMETRY_MSG_SCORE 0x03
+#define TELEMETRY_MSG_NEXT 0x04
+#define TELEMETRY_MSG_KEYFRAME 0x05
+
+#define TELEMETRY_RECORD_LOCK 0x80
+#define TELEMETRY_RECORD_SPAWN 0xA0
+#define TELEMETRY_RECORD_TYPE_MASK 0xE0
+#define TELEMETRY_KEYFRAME_LOCKS 16
+
+// Colour indices used in COLOURS messages
+#define TELEMETRY_COLOUR_BLACK 0
+#define TELEMETRY_COLOUR_RED 1
+#define TELEMETRY_COLOUR_GREEN 2
+#define TELEMETRY_COLOUR_YELLOW 3
+#define TELEMETRY_COLOUR_ORANGE 4
+#define TELEMETRY_COLOUR_LIGHT_ORANGE 5
+#define TELEMETRY_COLOUR_LIGHT_YELLOW 6
+#define TELEMETRY_COLOUR_LIGHT_GREEN 7
+#define TELEMETRY_COLOUR_GHOST 8
+#define TELEMETRY_COLOUR_OTHER 9
+#define TELEMETRY_MAX_RUN 16
+
+#define TELEMETRY_BOARD_ROWS 16
+#define TELEMETRY_BOARD_WIDTH 8
+#define TELEMETRY_BOARD_CELLS (TELEMETRY_BOARD_ROWS * TELEMETRY_BOARD_WIDTH)
+
+static inline uint8_t telemetry_crc8(uint8_t crc, uint8_t data) {
+	crc ^= data;
+	for(uint8_t bit = 0; bit < 8; bit++) {
+		crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : (crc << 1);
+	}
+	return crc;
+}
+
+/*
+ * Stream modes. In TELEMETRY_OFF the game is shown on the terminal with
+ * ANSI escape sequences as usual. In TELEMETRY_FRAMES the ANSI board,
+ * score and preview output is turned off and the messages above are sent
+ * instead. TELEMETRY_PLACEMENTS sends only LOCK/SPAWN records and
+ * keyframes.
+ */
+typedef enum {
+	TELEMETRY_OFF,
+	TELEMETRY_FRAMES,
+	TELEMETRY_PLACEMENTS,
+	TELEMETRY_NUM_MODES
+} TelemetryMode;
+
+void telemetry_set_mode(TelemetryMode mode);
+TelemetryMode telemetry_get_mode(void);
+
+/*
+ * Send messages for whatever has changed since the last call - the board
+ * (from board_display, or for placement mode the fixed blocks in board),
+ * the score and the next block. Messages are only sent if they fit in the
+ * serial output buffer. Returns 1 if some changes could not be sent (call
+ * again later), 0 otherwise.
+ */
+uint8_t telemetry_update(MatrixColumn* board_display, rowtype* board,
+		FallingBlock next);
+
+/*
+ * Placement records. telemetry_lock() should be called just before the
+ * given block is fixed to the board and telemetry_spawn() when a new block
+ * is added to the board. telemetry_board_replaced() should be called when
+ * the board changes in any other way (new game, game loaded).
+ */
+void telemetry_lock(FallingBlock block);
+void telemetry_spawn(FallingBlock block, FallingBlock next);
+void telemetry_board_replaced(void);
+
+#endif /* TELEMETRY_H_ */
@@ -7,237 +7,925 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <avr/pgmspace.h>
 
 #include "terminalio.h"
+#include "serialio.h"
+#include "timer0.h"
+#include "next_block_preview.h"
+
+/*
+ * Terminal state tracking.
+ * We remember what we last sent to the terminal - the cursor position, the
+ * SGR (display attribute) state, cursor visibility and the colour of each
+ * board cell - so that we only send escape sequences that change something,
+ * and so that cursor moves can use the shortest encoding available.
+ * A value of 0 for term_x/term_y (or TERM_UNKNOWN for the others) means we
+ * don't know the state and must send the full sequence next time.
+ * Text printed directly with printf() by other modules is not seen here, so
+ * move_cursor() forgets the cursor position once it has moved it.
+ */
+#define TERM_UNKNOWN 0xFF
+
+// SGR attributes 1 to 8 are kept as a bitmask (bit n is attribute n)
+#define ATTR_BIT(n) (1 << (n))
+
+static uint8_t term_x, term_y;
+static uint8_t term_attrs = TERM_UNKNOWN;
+static uint8_t term_fg, term_bg;	// 0 = terminal default
+static uint8_t term_cursor_visible = TERM_UNKNOWN;
+static uint8_t term_board[BOARD_ROWS][BOARD_WIDTH];	// fg code shown in each cell
+static uint16_t border_dirty;	// bit n set if row n of the border needs redrawing
+static uint8_t border_ends_dirty;	// top and bottom lines of the border
+static uint8_t preview_shown = TERM_UNKNOWN;	// (blocknum << 2) | rotation
+static uint32_t score_shown;
+static uint8_t score_shown_valid;
+
+// The board, score and preview output can be turned off (e.g. when the
+// game is being sent in another form over the serial line)
+static uint8_t output_enabled = 1;
+
+// Position of the top left board cell on the terminal
+#define BOARD_TERM_X 4
+#define BOARD_TERM_Y 6
+
+/*
+ * Frame scheduling. The board, score and next block preview are not drawn
+ * when they change - we just record what should be shown and terminal_draw()
+ * sends it later. Each call to terminal_draw() (a frame) sends at most
+ * refresh_max_bytes bytes and never more than will fit in the serial output
+ * buffer, so output never blocks. The regions are drawn in priority order:
+ * board (and its border), then score, then preview. Whatever doesn't fit is
+ * left for later frames; if the state changes again in the meantime only
+ * the newest state is drawn.
+ */
+static uint8_t board_pending;
+static uint8_t refresh_interval = TERMINAL_REFRESH_INTERVAL;
+static uint8_t refresh_max_bytes = TERMINAL_REFRESH_MAX_BYTES;
+
+static uint32_t score_wanted;
+static uint8_t score_wanted_valid;
+
+// Preview being drawn (a row at a time) and the one which should be shown
+static uint8_t preview_wanted = TERM_UNKNOWN;
+static uint8_t preview_drawing = TERM_UNKNOWN;
+static uint8_t preview_row;
+static const char* preview_text;	// start of preview_row in flash
+
+// Most bytes a single board cell can take: a cursor move (ESC[yy;xxH),
+// an SGR sequence (ESC[0;7;3xm) and the cell itself
+#define CELL_MAX_BYTES 18
+// Top or bottom line of the border: cursor move, SGR and the line
+#define BORDER_END_BYTES 24
+// Cursor move, SGR (ESC[0;37m), "Score: " and 10 digits
+#define SCORE_MAX_BYTES 31
+// Cursor move and SGR reset before a preview row
+#define PREVIEW_ROW_OVERHEAD 12
+// Bytes needed to return to normal display mode after drawing
+#define RESET_BYTES 4
+
+/*
+ * Run encoding. A run of board cells of the same colour can be sent as one
+ * cell followed by REP (ESC[nb - repeat the previous character n times), and
+ * a run of black cells as ECH (ESC[nX - erase n characters, which fills them
+ * with the current background colour). Whichever of these or plain spaces
+ * is shortest is used. Terminals which don't support REP get plain spaces -
+ * see terminal_probe_capabilities().
+ */
+static uint8_t use_run_encoding = (TERMINAL_REP_MODE == TERMINAL_REP_ON);
+
+// Count of bytes sent since the start of the current frame, and the limits
+// for the frame (both less RESET_BYTES)
+static uint8_t term_bytes;
+static uint8_t frame_budget;
+static uint8_t frame_space;
+
+/*
+ * Output groups. Everything this module sends is formatted straight into
+ * the serial output buffer in groups - a whole frame, or the escape
+ * sequences for one call of one of the public functions below - and each
+ * group is sent whole or not at all, so the terminal never sees half an
+ * escape sequence. term_begin() reserves space for a group, waiting for it
+ * or not according to the serial output policy (see serialio.h). If there
+ * is no room the group is discarded: we forget what we know about the
+ * terminal and flag that it needs to be redrawn (a resync).
+ * Groups can be nested - only the outermost one reserves space.
+ */
+#define GROUP_CLOSED 0
+#define GROUP_OPEN 1
+#define GROUP_DISCARD 2
+static uint8_t group_state;
+static uint8_t group_depth;
+static uint8_t resync_needed;
+
+// Largest cursor move (ESC[yyy;xxxH) and SGR sequence (every attribute
+// and both colours)
+#define GOTO_MAX_BYTES 10
+#define SGR_MAX_BYTES 22
+
+static void forget_terminal_state(void) {
+	term_x = 0;
+	term_y = 0;
+	term_attrs = TERM_UNKNOWN;
+	term_cursor_visible = TERM_UNKNOWN;
+}
+
+static void term_begin(uint8_t max_bytes) {
+	if(group_depth++ > 0) {
+		return;
+	}
+	if(serial_reserve(max_bytes)) {
+		group_state = GROUP_OPEN;
+	} else {
+		group_state = GROUP_DISCARD;
+		resync_needed = 1;
+	}
+}
+
+static void term_end(void) {
+	if(--group_depth > 0) {
+		return;
+	}
+	if(group_state == GROUP_OPEN) {
+		serial_commit();
+	} else {
+		forget_terminal_state();
+	}
+	group_state = GROUP_CLOSED;
+}
+
+static void term_putc(char c) {
+	if(group_state == GROUP_OPEN) {
+		if(c == '\n') {
+			serial_emit('\r');
+			term_bytes++;
+		}
+		serial_emit(c);
+	}
+	term_bytes++;
+}
+
+static void term_puts_P(const char* str) {
+	char c;
+	while((c = pgm_read_byte(str++)) != 0) {
+		term_putc(c);
+	}
+}
+
+static void term_put_uint8(uint8_t value) {
+	if(value >= 100) {
+		term_putc('0' + value / 100);
+	}
+	if(value >= 10) {
+		term_putc('0' + (value / 10) % 10);
+	}
+	term_putc('0' + value % 10);
+}
+
+static uint8_t num_digits(uint8_t value) {
+	return (value >= 100) ? 3 : (value >= 10) ? 2 : 1;
+}
+
+// Bytes needed for a relative move of n columns (ESC[C or ESC[nC)
+static uint8_t relative_move_cost(uint8_t n) {
+	return (n == 1) ? 3 : 3 + num_digits(n);
+}
+
+static void term_relative_move(uint8_t n, char direction) {
+	term_puts_P(PSTR("\x1b["));
+	if(n > 1) {
+		term_put_uint8(n);
+	}
+	term_putc(direction);
+}
+
+/*
+ * Move the cursor to (x,y) using the cheapest of: nothing, carriage return,
+ * line feeds, cursor forward/back, or an absolute ESC[y;xH.
+ */
+static void term_goto(uint8_t x, uint8_t y) {
+	enum { ABSOLUTE, SAME_ROW, NEXT_ROWS } method = ABSOLUTE;
+	uint8_t cost, best;
+	
+	if(term_x == x && term_y == y) {
+		return;
+	}
+	best = (x == 1) ? 3 + num_digits(y) : 4 + num_digits(y) + num_digits(x);
+	if(term_y != 0 && term_y == y) {
+		if(x > term_x) {
+			cost = relative_move_cost(x - term_x);
+		} else if(x == 1) {
+			cost = 1;
+		} else {
+			cost = relative_move_cost(term_x - x);
+		}
+		if(cost < best) {
+			method = SAME_ROW;
+		}
+	} else if(term_y != 0 && y > term_y && y - term_y <= 2) {
+		// Each '\n' is sent as "\r\n" by the serial module (see serialio.c)
+		cost = 2 * (y - term_y);
+		if(x > 1) {
+			cost += relative_move_cost(x - 1);
+		}
+		if(cost < best) {
+			method = NEXT_ROWS;
+		}
+	}
+	
+	switch(method) {
+		case SAME_ROW:
+			if(x > term_x) {
+				term_relative_move(x - term_x, 'C');
+			} else if(x == 1) {
+				term_putc('\r');
+			} else {
+				term_relative_move(term_x - x, 'D');
+			}
+			break;
+		case NEXT_ROWS:
+			while(term_y < y) {
+				term_putc('\n');
+				term_y++;
+			}
+			if(x > 1) {
+				term_relative_move(x - 1, 'C');
+			}
+			break;
+		default:
+			term_puts_P(PSTR("\x1b["));
+			term_put_uint8(y);
+			if(x != 1) {
+				term_putc(';');
+				term_put_uint8(x);
+			}
+			term_putc('H');
+			break;
+	}
+	term_x = x;
+	term_y = y;
+}
+
+// Output a string from program memory at the current cursor position.
+// The string must not contain control characters.
+static void term_print_P(const char* str) {
+	term_puts_P(str);
+	term_x += strlen_P(str);
+}
+
+/*
+ * Set the SGR state to the given attribute bitmask and foreground/background
+ * colours (0 meaning the terminal default). All the changes are combined
+ * into one escape sequence, and nothing is sent if nothing changes.
+ */
+// Attributes can only be turned off (cheaply) with a reset
+static uint8_t sgr_needs_reset(uint8_t attrs, uint8_t fg, uint8_t bg) {
+	return (term_attrs == TERM_UNKNOWN) || (term_attrs & ~attrs) ||
+			(fg == 0 && term_fg != 0) || (bg == 0 && term_bg != 0);
+}
+
+// Number of bytes term_set_sgr() would send for the given state
+static uint8_t sgr_cost(uint8_t attrs, uint8_t fg, uint8_t bg) {
+	uint8_t cost = 2;	// ESC and 'm'
+	uint8_t old_attrs = term_attrs, old_fg = term_fg, old_bg = term_bg;
+	
+	if(term_attrs == attrs && term_fg == fg && term_bg == bg) {
+		return 0;
+	}
+	if(sgr_needs_reset(attrs, fg, bg)) {
+		cost += 2;
+		old_attrs = 0;
+		old_fg = 0;
+		old_bg = 0;
+	}
+	// Each parameter is preceded by '[' or ';'
+	for(uint8_t attr = 1; attr <= TERM_HIDDEN; attr++) {
+		if((attrs & ATTR_BIT(attr)) && !(old_attrs & ATTR_BIT(attr))) {
+			cost += 2;
+		}
+	}
+	if(fg != old_fg) {
+		cost += 1 + num_digits(fg);
+	}
+	if(bg != old_bg) {
+		cost += 1 + num_digits(bg);
+	}
+	return cost;
+}
+
+static void term_set_sgr(uint8_t attrs, uint8_t fg, uint8_t bg) {
+	uint8_t need_reset;
+	char separator = '[';
+	
+	if(term_attrs == attrs && term_fg == fg && term_bg == bg) {
+		return;
+	}
+	need_reset = sgr_needs_reset(attrs, fg, bg);
+	if(need_reset) {
+		term_attrs = 0;
+		term_fg = 0;
+		term_bg = 0;
+	}
+	term_putc('\x1b');
+	if(need_reset) {
+		term_putc(separator);
+		term_putc('0');
+		separator = ';';
+	}
+	for(uint8_t attr = 1; attr <= TERM_HIDDEN; attr++) {
+		if((attrs & ATTR_BIT(attr)) && !(term_attrs & ATTR_BIT(attr))) {
+			term_putc(separator);
+			term_putc('0' + attr);
+			separator = ';';
+		}
+	}
+	if(fg != term_fg) {
+		term_putc(separator);
+		term_put_uint8(fg);
+		separator = ';';
+	}
+	if(bg != term_bg) {
+		term_putc(separator);
+		term_put_uint8(bg);
+	}
+	term_putc('m');
+	term_attrs = attrs;
+	term_fg = fg;
+	term_bg = bg;
+}
 
 void move_cursor(int8_t x, int8_t y) {
-    printf_P(PSTR("\x1b[%d;%dH"), y, x);
+	term_begin(GOTO_MAX_BYTES);
+	term_goto(x, y);
+	term_end();
+	// The caller will most likely print text we don't see - so forget
+	// where the cursor is
+	term_x = 0;
+	term_y = 0;
 }
 
 void normal_display_mode(void) {
-	printf_P(PSTR("\x1b[0m"));
+	term_begin(SGR_MAX_BYTES);
+	term_set_sgr(0, 0, 0);
+	term_end();
 }
 
 void reverse_video(void) {
-	printf_P(PSTR("\x1b[7m"));
+	set_display_attribute(TERM_REVERSE);
 }
 
 void clear_terminal(void) {
-	printf_P(PSTR("\x1b[2J"));
+	term_begin(4);
+	term_puts_P(PSTR("\x1b[2J"));
+	if(group_depth == 1 && group_state == GROUP_OPEN) {
+		// Starting again from a blank screen - anything lost so far no
+		// longer matters
+		serial_output_dropped();
+		resync_needed = 0;
+	}
+	term_end();
+	// Screen is now blank but we no longer know what we're looking at
+	// in any of the board positions
+	memset(term_board, TERM_UNKNOWN, sizeof(term_board));
+	board_pending = 1;
+	preview_shown = TERM_UNKNOWN;
+	preview_drawing = TERM_UNKNOWN;
+	score_shown_valid = 0;
 }
 
 void clear_to_end_of_line(void) {
-	printf_P(PSTR("\x1b[K"));
+	term_begin(3);
+	term_puts_P(PSTR("\x1b[K"));
+	term_end();
 }
 
 void set_display_attribute(DisplayParameter parameter) {
-	printf_P(PSTR("\x1b[%dm"), parameter);
+	uint8_t attrs = term_attrs;
+	uint8_t fg = term_fg;
+	uint8_t bg = term_bg;
+	
+	term_begin(SGR_MAX_BYTES);
+	if(term_attrs == TERM_UNKNOWN) {
+		// Don't know the state - just send what we were asked to send
+		// and work out the state from that
+		term_puts_P(PSTR("\x1b["));
+		term_put_uint8(parameter);
+		term_putc('m');
+		term_attrs = 0;
+		term_fg = 0;
+		term_bg = 0;
+		if(parameter != TERM_RESET) {
+			// Other attributes are unknown so state remains unknown
+			term_attrs = TERM_UNKNOWN;
+		}
+		term_end();
+		return;
+	}
+	if(parameter == TERM_RESET) {
+		attrs = 0;
+		fg = 0;
+		bg = 0;
+	} else if(parameter <= TERM_HIDDEN) {
+		attrs |= ATTR_BIT(parameter);
+	} else if(parameter <= FG_WHITE) {
+		fg = parameter;
+	} else {
+		bg = parameter;
+	}
+	term_set_sgr(attrs, fg, bg);
+	term_end();
 }
 
 void hide_cursor() {
-	printf_P(PSTR("\x1b[?25l"));
+	if(term_cursor_visible != 0) {
+		term_begin(6);
+		term_puts_P(PSTR("\x1b[?25l"));
+		term_cursor_visible = 0;
+		term_end();
+	}
 }
 
 void show_cursor() {
-	printf_P(PSTR("\x1b[?25h"));
+	if(term_cursor_visible != 1) {
+		term_begin(6);
+		term_puts_P(PSTR("\x1b[?25h"));
+		term_cursor_visible = 1;
+		term_end();
+	}
 }
 
 void enable_scrolling_for_whole_display(void) {
-	printf_P(PSTR("\x1b[r"));
+	term_begin(3);
+	term_puts_P(PSTR("\x1b[r"));
+	// Setting the scroll region homes the cursor
+	term_x = 1;
+	term_y = 1;
+	term_end();
 }
 
 void set_scroll_region(int8_t y1, int8_t y2) {
-	printf_P(PSTR("\x1b[%d;%dr"), y1, y2);
+	term_begin(10);
+	term_puts_P(PSTR("\x1b["));
+	term_put_uint8(y1);
+	term_putc(';');
+	term_put_uint8(y2);
+	term_putc('r');
+	term_x = 1;
+	term_y = 1;
+	term_end();
 }
 
 void scroll_down(void) {
-	printf_P(PSTR("\x1bM"));	// ESC-M
+	term_begin(2);
+	term_puts_P(PSTR("\x1bM"));	// ESC-M
+	term_y = 0;	// may or may not have moved
+	term_end();
 }
 
 void scroll_up(void) {
-	printf_P(PSTR("\x1b\x44"));	// ESC-D
+	term_begin(2);
+	term_puts_P(PSTR("\x1b\x44"));	// ESC-D
+	term_y = 0;
+	term_end();
 }
 
 void draw_horizontal_line(int8_t y, int8_t start_x, int8_t end_x) {
 	int8_t i;
-	move_cursor(start_x, y);
+	term_begin(GOTO_MAX_BYTES + 2 * SGR_MAX_BYTES + (end_x - start_x + 1));
+	term_goto(start_x, y);
 	reverse_video();
 	for(i=start_x; i <= end_x; i++) {
-		printf(" ");	/* No need to use printf_P - printing 
-						 * a single character gets optimised
-						 * to a putchar call 
-						 */
+		term_putc(' ');
+		term_x++;
 	}
 	normal_display_mode();
+	term_end();
 }
 
 void draw_vertical_line(int8_t x, int8_t start_y, int8_t end_y) {
 	int8_t i;
-	move_cursor(x, start_y);
 	reverse_video();
-	for(i=start_y; i < end_y; i++) {
-		printf(" ");
-		/* Move down one and back to the left one */
-		printf_P(PSTR("\x1b[B\x1b[D"));
+	for(i=start_y; i <= end_y; i++) {
+		// One group per line - a whole line could be too big
+		term_begin(GOTO_MAX_BYTES + 1);
+		term_goto(x, i);
+		term_putc(' ');
+		term_x++;
+		term_end();
 	}
-	printf(" ");
 	normal_display_mode();
 }
 
 void display_score(uint32_t score){
-	set_display_attribute(FG_WHITE);
-	move_cursor(3,3);
-	//print score
-	//max value of uint16_t is 10 chars
-	printf_P(PSTR("Score: %10d"), score);
+	//drawn by terminal_draw()
+	score_wanted = score;
+	score_wanted_valid = 1;
 }
 
+static uint8_t score_dirty(void) {
+	return score_wanted_valid && 
+			(!score_shown_valid || score_wanted != score_shown);
+}
 
-
-void terminal_draw(MatrixData displayMatrix) {
-	static char outputDisplay[100];
-	reverse_video();
-
-	//move to top left corner
-	move_cursor(4, 6);
-	//color info strings
-	char *color_code;
-	char *prev_code;
-	prev_code = "";
-	//loop through current display matrix
-	for (int i = 0; i < 16; i++) {
-		move_cursor(4,6+i);
-		//initialise string
-		strcpy(outputDisplay,"");
-		for (int j = 0; j < BOARD_WIDTH; j++) {
-			//convert colours
-			switch (displayMatrix[i][j]) {
-				case COLOUR_BLACK :
-					color_code = "30";
-					break;
-				case COLOUR_RED :
-					color_code = "31";
-					break;
-				case COLOUR_GREEN :
-					color_code = "32";
-					break;
-				case COLOUR_YELLOW :
-					color_code = "33";
-					break;
-				case COLOUR_ORANGE :
-					color_code = "34";
-					break;
-				case COLOUR_LIGHT_ORANGE :
-					color_code = "35";
-					break;
-				case COLOUR_LIGHT_YELLOW :
-					color_code = "35";
-					break;
-				case COLOUR_LIGHT_GREEN :
-					color_code = "37";
-					break;
-				case 0x11 :
-					color_code = "36";
-					break;
-				default:
-					color_code = "30";
-			}
-			if (prev_code != color_code) {
-				//add hash and colour code to string
-				//if different
-				strcat(outputDisplay,"\x1b[");
-				strcat(outputDisplay,color_code);
-				strcat(outputDisplay,"m ");
-				prev_code = color_code;
-			} else {
-				//colour is the same as the block before
-				//no need to send colour info
-				strcat(outputDisplay, " ");
-			}
-			//output			
-		}
-		printf("%s",outputDisplay);
-	}
-	normal_display_mode();
-	
-	
+static uint8_t preview_dirty(void) {
+	return preview_wanted != TERM_UNKNOWN && preview_wanted != preview_shown;
 }
 
-void draw_game_window(void) {
-	set_display_attribute(FG_WHITE);
-	move_cursor(3, 5);
-	printf_P(PSTR("##########"));
-	for (int i = 0; i< 16; i++) {
-		move_cursor(3, 6 + i);
-		printf_P(PSTR("#        #"));
+/*
+ * Returns non-zero if something of (at most) cost bytes can be sent in
+ * this frame. Something too big for any frame may go on its own if it
+ * fits in the serial output buffer.
+ */
+static uint8_t frame_has_room(uint8_t cost) {
+	if(term_bytes + cost <= frame_budget) {
+		return 1;
 	}
-	move_cursor(3, 22);
-	printf_P(PSTR("##########"));
+	return term_bytes == 0 && cost <= frame_space;
 }
 
-void draw_next_block(FallingBlock block) {
-	move_cursor(20, 10);
-	printf("     ");
-	move_cursor(20, 11);
-	printf("     ");
-	move_cursor(20, 12);
-	printf("     ");
-	move_cursor(20, 13);
-	printf("     ");
-	move_cursor(20, 14);
-	printf("     ");
-	move_cursor(20, 10);
-	char output[50];
-	char *color_code;
-	strcpy(output, "");
-	reverse_video();
-	//convert colours
-	switch (block.colour) {
-		case COLOUR_BLACK :
-		color_code = "30";
-		break;
+// Convert a board colour to the foreground colour code used to draw it
+// (we draw in reverse video so this becomes the background of the cell)
+static uint8_t board_colour_code(PixelColour colour) {
+	switch (colour) {
 		case COLOUR_RED :
-		color_code = "31";
-		break;
+			return FG_RED;
 		case COLOUR_GREEN :
-		color_code = "32";
-		break;
+			return FG_GREEN;
 		case COLOUR_YELLOW :
-		color_code = "33";
-		break;
+			return FG_YELLOW;
 		case COLOUR_ORANGE :
-		color_code = "34";
-		break;
+			return FG_BLUE;
 		case COLOUR_LIGHT_ORANGE :
-		color_code = "35";
-		break;
 		case COLOUR_LIGHT_YELLOW :
-		color_code = "36";
-		break;
+			return FG_MAGENTA;
 		case COLOUR_LIGHT_GREEN :
-		color_code = "37";
-		break;
+			return FG_WHITE;
+		case 0x11 :
+			return FG_CYAN;
 		default:
-		color_code = "30";
-	}
-	for(uint8_t row = 0; row < block.height; row++) {
-		for(int col = (block.width - 1); col >= 0; col--) {
-			if(block.pattern[row] & (1 << col)) {
-				strcat(output,"\x1b[");
-				strcat(output,color_code);
-				strcat(output,"m ");
-			} else {
-				strcat(output,"\x1b[");
-				strcat(output,"30");
-				strcat(output,"m ");
+			return FG_BLACK;
+	}
+}
+
+void terminal_set_output_enabled(uint8_t enabled) {
+	output_enabled = enabled;
+	// Whatever is on the terminal now, it isn't what we last drew
+	memset(term_board, TERM_UNKNOWN, sizeof(term_board));
+	border_dirty = 0;
+	border_ends_dirty = 0;
+	preview_shown = TERM_UNKNOWN;
+	preview_drawing = TERM_UNKNOWN;
+	score_shown_valid = 0;
+	term_x = 0;
+	term_y = 0;
+	term_attrs = TERM_UNKNOWN;
+	board_pending = enabled;
+}
+
+void terminal_board_changed(void) {
+	board_pending = 1;
+}
+
+uint8_t terminal_resync_needed(void) {
+	if(serial_output_dropped()) {
+		// Someone else's output was lost - it may have been ours
+		resync_needed = 1;
+	}
+	// (Telemetry modes redraw the terminal when they're turned off)
+	return resync_needed && output_enabled;
+}
+
+uint8_t terminal_refresh_pending(void) {
+	return board_pending || 
+			(output_enabled && (score_dirty() || preview_dirty()));
+}
+
+void terminal_set_refresh_limits(uint8_t interval, uint8_t max_bytes) {
+	refresh_interval = interval;
+	refresh_max_bytes = max_bytes;
+}
+
+uint8_t terminal_refresh_interval(void) {
+	return refresh_interval;
+}
+
+/*
+ * Draw run board cells (in the given row, starting at col) in the colour
+ * with the given code, using the shortest encoding. Returns 0 (having sent
+ * nothing) if there isn't room in this frame.
+ */
+static uint8_t draw_cells(uint8_t col, uint8_t row, uint8_t run, uint8_t code) {
+	enum { SPACES, REPEAT, ERASE } method = SPACES;
+	uint8_t reverse = ATTR_BIT(TERM_REVERSE);
+	uint8_t cost, best;
+	
+	best = sgr_cost(reverse, code, 0) + run;
+	if (run > 1) {
+		cost = sgr_cost(reverse, code, 0) + 4 + num_digits(run - 1);
+		if (cost < best) {
+			method = REPEAT;
+			best = cost;
+		}
+		if (code == FG_BLACK) {
+			// Erased cells take the background colour, so a reverse video
+			// black cell looks the same as an erased cell on a black
+			// background
+			cost = sgr_cost(0, 0, BG_BLACK) + 3 + num_digits(run);
+			if (cost < best) {
+				method = ERASE;
+				best = cost;
 			}
 		}
-		//add new line string and move cursor
-		strcat(output,"\n");
-		strcat(output,"\033[19C");
 	}
-	printf("%s", output); 
-	normal_display_mode();
-}
\ No newline at end of file
+	// Allow for the worst case cursor move (ESC[yy;xxH)
+	if (!frame_has_room(best + 8)) {
+		return 0;
+	}
+	term_goto(BOARD_TERM_X + col, BOARD_TERM_Y + row);
+	switch (method) {
+		case ERASE:
+			term_set_sgr(0, 0, BG_BLACK);
+			term_puts_P(PSTR("\x1b["));
+			term_put_uint8(run);
+			term_putc('X');
+			//cursor doesn't move
+			break;
+		case REPEAT:
+			term_set_sgr(reverse, code, 0);
+			term_putc(' ');
+			term_puts_P(PSTR("\x1b["));
+			term_put_uint8(run - 1);
+			term_putc('b');
+			term_x += run;
+			break;
+		default:
+			term_set_sgr(reverse, code, 0);
+			for (uint8_t i = 0; i < run; i++) {
+				term_putc(' ');
+			}
+			term_x += run;
+			break;
+	}
+	memset(&term_board[row][col], code, run);
+	return 1;
+}
+
+/*
+ * Bring the board (and its border) on the terminal up to date with
+ * displayMatrix. Only the cells which differ from what we last drew are
+ * sent. Leaves board_pending set if the frame ran out of room.
+ */
+static void draw_board(MatrixData displayMatrix) {
+	board_pending = 0;
+	if (border_ends_dirty) {
+		if (!frame_has_room(2 * BORDER_END_BYTES)) {
+			board_pending = 1;
+			return;
+		}
+		term_set_sgr(0, FG_WHITE, 0);
+		term_goto(BOARD_TERM_X - 1, BOARD_TERM_Y - 1);
+		term_print_P(PSTR("##########"));
+		term_goto(BOARD_TERM_X - 1, BOARD_TERM_Y + BOARD_ROWS);
+		term_print_P(PSTR("##########"));
+		border_ends_dirty = 0;
+	}
+	for (uint8_t row = 0; row < BOARD_ROWS && border_dirty; row++) {
+		if (!(border_dirty & (1 << row))) {
+			continue;
+		}
+		if (!frame_has_room(2 * CELL_MAX_BYTES)) {
+			board_pending = 1;
+			return;
+		}
+		term_set_sgr(0, FG_WHITE, 0);
+		term_goto(BOARD_TERM_X - 1, BOARD_TERM_Y + row);
+		term_print_P(PSTR("#"));
+		term_goto(BOARD_TERM_X + BOARD_WIDTH, BOARD_TERM_Y + row);
+		term_print_P(PSTR("#"));
+		border_dirty &= ~(1 << row);
+	}
+	for (uint8_t row = 0; row < BOARD_ROWS; row++) {
+		uint8_t col = 0;
+		while (col < BOARD_WIDTH) {
+			uint8_t code = board_colour_code(displayMatrix[row][col]);
+			uint8_t run = 1;
+			if (term_board[row][col] == code) {
+				//terminal already shows this colour
+				col++;
+				continue;
+			}
+			if (use_run_encoding) {
+				//extend the run to the last cell of this colour which
+				//needs drawing
+				for (uint8_t end = col + 1; end < BOARD_WIDTH && 
+						board_colour_code(displayMatrix[row][end]) == code; end++) {
+					if (term_board[row][end] != code) {
+						run = end - col + 1;
+					}
+				}
+			}
+			if (!draw_cells(col, row, run, code)) {
+				//out of room - finish next time
+				board_pending = 1;
+				return;
+			}
+			col += run;
+		}
+	}
+}
+
+// Returns 0 if the score didn't fit in this frame
+static uint8_t draw_score(void) {
+	char digits[10];
+	uint8_t length;
+	
+	if (!frame_has_room(SCORE_MAX_BYTES)) {
+		return 0;
+	}
+	// Reset first - the board may have left reverse video on
+	term_set_sgr(0, FG_WHITE, 0);
+	term_goto(3,3);
+	term_print_P(PSTR("Score: "));
+	//max value of uint32_t is 10 chars
+	length = serial_format_uint32(digits, score_wanted, 10);
+	for (uint8_t i = 0; i < length; i++) {
+		term_putc(digits[i]);
+	}
+	term_x += length;
+	score_shown = score_wanted;
+	score_shown_valid = 1;
+	return 1;
+}
+
+/*
+ * Draw as many rows of the wanted preview as fit in this frame. The
+ * sequences for each block and rotation are generated ahead of time (see
+ * next_block_preview.h) with rows separated by '\n'. If the wanted preview
+ * changes part way through we start again with the new one.
+ */
+static void draw_preview(void) {
+	if (preview_drawing != preview_wanted) {
+		preview_drawing = preview_wanted;
+		preview_row = 0;
+		preview_text = (const char*)pgm_read_word(
+				&preview_strings[preview_wanted >> 2][preview_wanted & 3]);
+	}
+	while (preview_row < PREVIEW_SIZE) {
+		uint8_t length = 0;
+		char c;
+		
+		while ((c = pgm_read_byte(preview_text + length)) != '\n' && c != 0) {
+			length++;
+		}
+		if (!frame_has_room(length + PREVIEW_ROW_OVERHEAD)) {
+			return;
+		}
+		term_set_sgr(0, 0, 0);
+		term_goto(PREVIEW_X, PREVIEW_Y + preview_row);
+		while (length--) {
+			term_putc(pgm_read_byte(preview_text++));
+		}
+		preview_text++;		// skip the separator
+		term_x += PREVIEW_SIZE;
+		preview_row++;
+	}
+	preview_shown = preview_drawing;
+}
+
+/*
+ * Send the next frame - see "Frame scheduling" above. A region is only
+ * drawn once the regions before it are complete.
+ */
+void terminal_draw(MatrixData displayMatrix) {
+	uint8_t space = serial_output_space();
+	
+	if (!output_enabled) {
+		board_pending = 0;
+		return;
+	}
+	if (space < RESET_BYTES + CELL_MAX_BYTES) {
+		return;
+	}
+	frame_space = space - RESET_BYTES;
+	frame_budget = (refresh_max_bytes < space ? refresh_max_bytes : space) 
+			- RESET_BYTES;
+	term_bytes = 0;
+	// The whole frame is one output group. (We're the only writer so the
+	// space can't go away.)
+	term_begin(space);
+	
+	if (board_pending) {
+		draw_board(displayMatrix);
+	}
+	if (!board_pending && (!score_dirty() || draw_score()) && preview_dirty()) {
+		draw_preview();
+	}
+	if (term_bytes) {
+		normal_display_mode();
+	}
+	term_end();
+}
+
+/*
+ * Show the removal of the given (completed) board row. Rather than
+ * repainting the board we set the scroll region to the board rows from
+ * the top down to the removed row and scroll that region down by one line.
+ * Only the newly exposed top row (and its border) then needs to be drawn,
+ * which happens on the next terminal_draw().
+ * Note that the scroll region spans the full width of the terminal so
+ * anything to the right of the board on those lines moves as well.
+ */
+void terminal_remove_row(uint8_t row) {
+	if (!output_enabled) {
+		return;
+	}
+	if (row > 0) {
+		term_begin(SGR_MAX_BYTES + 10 + GOTO_MAX_BYTES + 2 + 3);
+		// New line is filled with the current background - use the default
+		normal_display_mode();
+		set_scroll_region(BOARD_TERM_Y, BOARD_TERM_Y + row);
+		term_goto(1, BOARD_TERM_Y);
+		// Reverse index at the top of the scroll region scrolls it down
+		term_puts_P(PSTR("\x1bM"));
+		enable_scrolling_for_whole_display();
+		term_end();
+		for (uint8_t r = row; r > 0; r--) {
+			memcpy(term_board[r], term_board[r-1], BOARD_WIDTH);
+		}
+		border_dirty = (border_dirty & ~((2 << row) - 1)) |
+				((border_dirty << 1) & ((2 << row) - 1));
+		if (BOARD_TERM_Y + row >= PREVIEW_Y) {
+			// Preview was (partly) scrolled as well
+			preview_shown = TERM_UNKNOWN;
+			preview_drawing = TERM_UNKNOWN;
+		}
+	}
+	// Top row is now blank (or is the row being removed)
+	memset(term_board[0], TERM_UNKNOWN, BOARD_WIDTH);
+	border_dirty |= 1;
+	board_pending = 1;
+}
+
+void draw_game_window(void) {
+	// The border is drawn by terminal_draw(), ahead of the board cells
+	border_dirty = 0xFFFF;
+	border_ends_dirty = 1;
+	board_pending = 1;
+}
+
+void draw_next_block(FallingBlock block) {
+	//drawn by terminal_draw()
+	preview_wanted = (block.blocknum << 2) | block.rotation;
+}
+
+/*
+ * Find out whether the terminal supports REP by printing one character,
+ * repeating it three times and asking for the cursor position (DSR). A
+ * terminal which supports REP reports column 5. Other terminals (or no
+ * reply within TERMINAL_PROBE_TIMEOUT ms) leave run encoding off. Must be
+ * called with interrupts on, before the game starts reading serial input.
+ * ECH is sent before the DSR too, which catches terminals that print
+ * sequences they don't know (the column is then wrong). ECH doesn't move
+ * the cursor, so a terminal which silently ignores it can't be told apart
+ * from one which carries it out - we rely on REP being the rarer of the
+ * two. (ECH dates from the VT220, whereas no DEC terminal had REP - it is
+ * found in xterm and the terminals modelled on it, which all have ECH.)
+ */
+void terminal_probe_capabilities(void) {
+#if TERMINAL_REP_MODE == TERMINAL_REP_PROBE
+	uint32_t start;
+	uint8_t column = 0;
+	uint8_t state = 0;	// 0 = waiting for ';', 1 = column digits, 2 = done
+	
+	term_begin(20);
+	term_puts_P(PSTR("\x1b[1;1H \x1b[3b\x1b[1X\x1b[6n"));
+	term_end();
+	start = get_clock_ticks();
+	while (state != 2 &&
+			!clock_reached(get_clock_ticks(), start + TERMINAL_PROBE_TIMEOUT)) {
+		int c;
+		if (!serial_input_available()) {
+			continue;
+		}
+		//reply is ESC [ row ; column R
+		c = fgetc(stdin);
+		if (state == 0 && c == ';') {
+			state = 1;
+		} else if (state == 1 && c >= '0' && c <= '9') {
+			column = column * 10 + (c - '0');
+		} else if (state == 1) {
+			state = 2;
+		}
+	}
+	use_run_encoding = (state == 2 && column == 5);
+	clear_serial_input_buffer();
+	//tidy up the probe
+	term_begin(4);
+	term_puts_P(PSTR("\r\x1b[K"));
+	term_x = 1;
+	term_y = 1;
+	term_end();
+#endif
+}
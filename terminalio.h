@@ -90,7 +90,7 @@ void scroll_up(void);
 void draw_horizontal_line(int8_t y, int8_t startx, int8_t endx);
 void draw_vertical_line(int8_t x, int8_t starty, int8_t endy);
 
-//display the current score
+//display the current score (drawn by the next terminal_draw())
 void display_score(uint32_t);
 
 #define MATRIX_NUM_COLUMNS 16
@@ -102,8 +102,64 @@ void display_score(uint32_t);
 // Data types which can be used to store display information
 typedef PixelColour MatrixData[MATRIX_NUM_COLUMNS][MATRIX_NUM_ROWS];
 
+/*
+ * The board, score and next block preview are redrawn on the terminal only
+ * when they have changed, no more often than every TERMINAL_REFRESH_INTERVAL
+ * ms, and each refresh sends at most TERMINAL_REFRESH_MAX_BYTES bytes (the
+ * rest is sent by later refreshes, board first, then score, then preview).
+ * The defaults suit 19200 baud (1920 bytes/second).
+ */
+#define TERMINAL_REFRESH_INTERVAL 20
+#define TERMINAL_REFRESH_MAX_BYTES 38
+
+/*
+ * Use of REP (repeat character) for runs of board cells of the same colour,
+ * and ECH (erase characters) for runs of black cells:
+ * TERMINAL_REP_OFF - never, always send spaces
+ * TERMINAL_REP_ON - always (the terminal must support REP and ECH)
+ * TERMINAL_REP_PROBE - if terminal_probe_capabilities() finds they work
+ * TERMINAL_REP_MODE can be defined when compiling to choose one of these.
+ */
+#define TERMINAL_REP_OFF 0
+#define TERMINAL_REP_ON 1
+#define TERMINAL_REP_PROBE 2
+#ifndef TERMINAL_REP_MODE
+#define TERMINAL_REP_MODE TERMINAL_REP_PROBE
+#endif
+#define TERMINAL_PROBE_TIMEOUT 100
+
+// Check which optional escape sequences the terminal supports (see above).
+// Leaves the cursor at the top left of the screen.
+void terminal_probe_capabilities(void);
+
+// Turn the board, score and next block output on or off. After turning it
+// back on the terminal should be cleared and the game window redrawn.
+void terminal_set_output_enabled(uint8_t enabled);
+
+// Note that the board has changed and needs to be redrawn
+void terminal_board_changed(void);
+
+// Returns non-zero if the board, score or preview needs (more) redrawing
+uint8_t terminal_refresh_pending(void);
+
+// Returns non-zero if terminal output has been discarded (see the serial
+// output policy in serialio.h) so the terminal must be cleared and
+// everything redrawn. Cleared by clear_terminal(). Always 0 while board
+// output is turned off.
+uint8_t terminal_resync_needed(void);
+
+// Change the refresh interval (ms) and the maximum bytes sent per refresh
+void terminal_set_refresh_limits(uint8_t interval, uint8_t max_bytes);
+uint8_t terminal_refresh_interval(void);
+
 void terminal_draw(MatrixData displayMatrix); 
 
+// Show the removal of a completed board row (rows above it move down one).
+// Call after the row has been removed from the board.
+void terminal_remove_row(uint8_t row);
+
+// Draw the border around the board and show the given next block. Both
+// are drawn by the next terminal_draw() calls.
 void draw_game_window(void);
 
 void draw_next_block(FallingBlock block);
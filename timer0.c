@@ -5,7 +5,8 @@
  *
  * We setup timer0 to generate an interrupt every 1ms
  * We update a global clock tick variable - whose value
- * can be retrieved using the get_clock_ticks() function.
+ * can be retrieved using the get_clock_ticks() function -
+ * and run the soft timers.
  */
 
 #include <avr/io.h>
@@ -17,6 +18,25 @@
  * millisecond. Will overflow every ~49 days. */
 static volatile uint32_t clock_ticks;
 
+/* The bottom 16 bits of clock_ticks, kept separately so they can be read
+ * without reading all four bytes of clock_ticks. */
+static volatile uint16_t clock_ticks16;
+
+/* Set while the clock is stopped (see toggle_timer()) */
+static volatile uint8_t clock_stopped;
+
+/* Soft timers. countdown is the number of milliseconds until the
+ * callback is next called.
+ */
+typedef struct {
+	SoftTimerCallback callback;
+	uint8_t period;
+	uint8_t countdown;
+} SoftTimer;
+
+static SoftTimer soft_timers[MAX_SOFT_TIMERS];
+static volatile uint8_t num_soft_timers;
+
 /* Set up timer 0 to generate an interrupt every 1ms. 
  * We will divide the clock by 64 and count up to 124.
  * We will therefore get an interrupt every 64 x 125
@@ -30,6 +50,7 @@ void init_timer0(void) {
 	 * constant. 
 	 */
 	clock_ticks = 0L;
+	clock_ticks16 = 0;
 	
 	/* Clear the timer */
 	TCNT0 = 0;
@@ -60,23 +81,70 @@ void init_timer0(void) {
 uint32_t get_clock_ticks(void) {
 	uint32_t return_value;
 
-	/* Disable interrupts so we can be sure that the interrupt
-	 * doesn't fire when we've copied just a couple of bytes
-	 * of the value. Interrupts are re-enabled if they were
-	 * enabled at the start.
+	/* Read the count until we get the same value twice, so we can be
+	 * sure that the interrupt didn't fire when we'd copied just a couple
+	 * of bytes of it. This doesn't need interrupts to be turned off, so
+	 * it doesn't hold up the other interrupt handlers. (In an interrupt
+	 * handler the count can't change, so the first read is enough.)
 	 */
-	uint8_t interrupts_were_on = bit_is_set(SREG, SREG_I);
-	cli();
-	return_value = clock_ticks;
-	if(interrupts_were_on) {
-		sei();
-	}
+	do {
+		return_value = clock_ticks;
+	} while(return_value != clock_ticks);
 	return return_value;
 }
 
+uint16_t get_clock_ticks16(void) {
+	uint16_t return_value;
+
+	/* As above, but we only need to copy two bytes */
+	do {
+		return_value = clock_ticks16;
+	} while(return_value != clock_ticks16);
+	return return_value;
+}
+
+uint16_t get_fine_clock(void) {
+	uint16_t ticks;
+	uint8_t count, pending;
+
+	/* Read the count and the timer until the count hasn't changed. If the
+	 * timer has just gone round and interrupts are off (so the interrupt
+	 * which counts that millisecond can't run yet) we count it ourselves.
+	 */
+	do {
+		ticks = clock_ticks16;
+		count = TCNT0;
+		pending = TIFR0 & (1<<OCF0A);
+	} while(ticks != clock_ticks16);
+	if(clock_stopped) {
+		count = 0;
+	} else if(pending && count < (OCR0A / 2)) {
+		ticks++;
+	}
+	return ticks * (OCR0A + 1) + count;
+}
+
 void toggle_timer(void) {
-	TCCR0B ^= (1<<CS01)|(1<<CS00);
+	clock_stopped ^= 1;
+}
+
+int8_t add_soft_timer(SoftTimerCallback callback, uint8_t period) {
+	int8_t index = -1;
 
+	/* The interrupt handler mustn't see a half added timer */
+	uint8_t interrupts_were_on = bit_is_set(SREG, SREG_I);
+	cli();
+	if(num_soft_timers < MAX_SOFT_TIMERS) {
+		index = num_soft_timers;
+		soft_timers[index].callback = callback;
+		soft_timers[index].period = period;
+		soft_timers[index].countdown = period;
+		num_soft_timers++;
+	}
+	if(interrupts_were_on) {
+		sei();
+	}
+	return index;
 }
 
 
@@ -84,6 +152,18 @@ void toggle_timer(void) {
  * the defined output compare value (every millisecond)
  */
 ISR(TIMER0_COMPA_vect) {
-	/* Increment our clock tick count */
-	clock_ticks++;
+	/* Increment our clock tick count (unless the clock is stopped) */
+	if(!clock_stopped) {
+		clock_ticks++;
+		clock_ticks16++;
+	}
+	
+	/* Run the soft timers which are due */
+	for(uint8_t i = 0; i < num_soft_timers; i++) {
+		SoftTimer* timer = &soft_timers[i];
+		if(--timer->countdown == 0) {
+			timer->countdown = timer->period;
+			timer->callback();
+		}
+	}
 }
\ No newline at end of file
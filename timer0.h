@@ -6,8 +6,9 @@
  * We set up timer 0 to give us an interrupt
  * every millisecond. Tasks that have to occur
  * regularly (every millisecond or few) can be added 
- * to the interrupt handler (in timer0.c) or can
- * be added to the main event loop that checks the
+ * to the interrupt handler as soft timers (see
+ * add_soft_timer()) or can be added to the main
+ * program (see scheduler.h) which checks the
  * clock tick value. This value (32 bits) can be 
  * obtained using the get_clock_ticks() function.
  * (Any tasks undertaken in the interrupt handler
@@ -20,6 +21,11 @@
 
 #include <stdint.h>
 
+/* Most soft timers which can be added */
+#define MAX_SOFT_TIMERS 4
+
+typedef void (*SoftTimerCallback)(void);
+
 /* Set up our timer to give us an interrupt every millisecond
  * and update our time reference. Note: interrupts will need 
  * to be enabled globally for this to work.
@@ -27,11 +33,43 @@
 void init_timer0(void);
 
 /* Return the current clock tick value - milliseconds since the timer was
- * initialised.
+ * initialised. Doesn't turn interrupts off, so may be called as often as
+ * needed.
  */
 uint32_t get_clock_ticks(void);
 
-//Toggle whether the timer is on or off
+/* Return the bottom 16 bits of the clock tick value (wraps every 65
+ * seconds). Cheaper, for timing things which are never that far apart.
+ */
+uint16_t get_clock_ticks16(void);
+
+/* Wrap safe comparisons of clock tick values - return non-zero if time
+ * has been reached at now. (They compare the difference between the times
+ * so give the right answer as long as the times are less than half the
+ * wrap time apart.)
+ */
+static inline uint8_t clock_reached(uint32_t now, uint32_t time) {
+	return (int32_t)(now - time) >= 0;
+}
+static inline uint8_t clock16_reached(uint16_t now, uint16_t time) {
+	return (int16_t)(now - time) >= 0;
+}
+
+/* Return the time in timer 0 counts (units of 8 microseconds). Wraps
+ * every 524ms so is only for timing short intervals. May be called from
+ * interrupt handlers.
+ */
+uint16_t get_fine_clock(void);
+
+/* Stop the clock, or start it again (e.g. while the game is paused). The
+ * timer keeps running, as do the soft timers and the joystick sampling.
+ */
 void toggle_timer(void);
 
+/* Have callback called by the timer 0 interrupt handler every period
+ * milliseconds (1 to 255), whether or not the clock is stopped. Returns
+ * the soft timer number, or -1 if there are already MAX_SOFT_TIMERS.
+ */
+int8_t add_soft_timer(SoftTimerCallback callback, uint8_t period);
+
 #endif
\ No newline at end of file
@@ -54,7 +54,6 @@ ________________________________________________________________________________
 #include <avr/interrupt.h>
 
 #include "timer1.h"
-#include "timer2.h"
 
 //OCRA values, the note "frequency" array (see table above)
 //Let 1ms be 1000 in this array